@@ -30,10 +30,22 @@
 #include <stdio.h> // for printf, stdin, stdout etc
 #include <string.h> // for strdup
 #include <stdlib.h> // for atoi
+#include <math.h> // for sqrt
 #include <sys/time.h> // for gettimeofday etc (on Linux builds)
+#include <time.h> // for clock_gettime, timing the benchmarks
+#if defined (__GLIBC__)
+#include <malloc.h> // for mallinfo2, watching the heap while fuzzing
+#endif
+#include <sys/wait.h> // for waitpid, when running sharded ensembles
+#include <sys/stat.h> // for stat, so --merge can tell when its output is one of its inputs
+#include <unistd.h> // for fork, _exit
+#include <pthread.h> // for running ensemble replicas on several threads (build with -pthread)
+#include <sched.h> // for sched_getaffinity, when pinning threads to cores
+#include <sys/mman.h> // for mmap/madvise, to back large belts with huge pages
 
 // GK: For portability, use internal type names and map them here
 typedef u_int64_t u64int;
+typedef unsigned __int128 u128int; // GK: GCC/Clang extension, for sums of squares and long run schedules that can't overflow
 typedef u_int32_t u32int;
 typedef u_int8_t u8int;
 typedef u_int8_t ascii;
@@ -44,12 +56,216 @@ typedef float probability;
 //#define DEBUG printf
 #define DEBUG(...) {}
 
+// USDT (user-level statically defined tracing) probes, so a running simulation can be looked into with bpftrace or
+// perf without a rebuild, e.g. to count pickups by item:
+//   bpftrace -e 'usdt:./challenge:armline:pickup { @[arg1] = count(); }'
+// A probe with nothing attached is a single NOP.  They need <sys/sdt.h> (from systemtap's sdt headers); without it,
+// or built with -DNO_LINE_PROBES, they compile to nothing.
+#if !defined(NO_LINE_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define LINE_PROBES 1
+#endif
+#endif
+
+#ifdef LINE_PROBES
+#define LINE_PROBE0(name) DTRACE_PROBE(armline, name)
+#define LINE_PROBE1(name, a) DTRACE_PROBE1(armline, name, a)
+#define LINE_PROBE2(name, a, b) DTRACE_PROBE2(armline, name, a, b)
+#else
+#define LINE_PROBE0(name) {}
+#define LINE_PROBE1(name, a) {}
+#define LINE_PROBE2(name, a, b) {}
+#endif
+
+// Allocation tracking: built with -DTRACK_ALLOCATIONS, every malloc, calloc, realloc (and so every new) is counted
+// against the phase the calling thread is in: setting a line up, running it, and reporting.  Everything a line needs
+// is made when it is set up (see Belt::prepare), so running must not allocate at all, from the first step on, and a
+// run which does fails, so nothing sneaks a malloc into the step loop unnoticed.  In ordinary builds the phase
+// changes compile to nothing.
+enum AllocationPhase
+{
+  ALLOC_SETUP,
+  ALLOC_RUN,
+  ALLOC_REPORT,
+  NUMBER_OF_ALLOC_PHASES
+};
+
+#ifdef TRACK_ALLOCATIONS
+#include <new> // for std::bad_alloc
+
+static const char *allocationPhaseNames[NUMBER_OF_ALLOC_PHASES] = { "setup", "run", "report" };
+static u64int allocationCounts[NUMBER_OF_ALLOC_PHASES]; // Across all threads, added to atomically
+static thread_local u8int allocationPhase = ALLOC_SETUP;
+
+inline void setAllocationPhase ( u8int phase )
+{
+  allocationPhase = phase;
+}
+
+inline void countAllocation ()
+{
+  __atomic_fetch_add ( &allocationCounts[allocationPhase], 1, __ATOMIC_RELAXED );
+}
+
+#if defined (__GLIBC__)
+// GK: glibc lets us interpose on malloc itself, and exports the real ones under these names
+extern "C" void *__libc_malloc ( size_t size );
+extern "C" void *__libc_calloc ( size_t n, size_t size );
+extern "C" void *__libc_realloc ( void *p, size_t size );
+
+extern "C" void *malloc ( size_t size )
+{
+  countAllocation();
+  return __libc_malloc ( size );
+}
+
+extern "C" void *calloc ( size_t n, size_t size )
+{
+  countAllocation();
+  return __libc_calloc ( n, size );
+}
+
+extern "C" void *realloc ( void *p, size_t size )
+{
+  countAllocation();
+  return __libc_realloc ( p, size );
+}
+#endif
+
+// new goes through malloc (and is counted there, where we can hook malloc)
+void *operator new ( size_t size )
+{
+#if !defined (__GLIBC__)
+  countAllocation();
+#endif
+  void *p = malloc ( size );
+  if ( p == NULL )
+  {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void *operator new[] ( size_t size )
+{
+  return operator new ( size );
+}
+
+// GK: Kept out of line, or GCC sees free() called on what new returned, and warns of a mismatch
+__attribute__((noinline)) void operator delete ( void *p ) noexcept
+{
+  free ( p );
+}
+
+__attribute__((noinline)) void operator delete[] ( void *p ) noexcept
+{
+  free ( p );
+}
+
+__attribute__((noinline)) void operator delete ( void *p, size_t ) noexcept
+{
+  free ( p );
+}
+
+__attribute__((noinline)) void operator delete[] ( void *p, size_t ) noexcept
+{
+  free ( p );
+}
+
+// Prints the counts per phase, returning false if anything was allocated while a line ran
+bool checkAllocations ()
+{
+  printf("Allocations:");
+  for ( u32int ph = 0; ph < NUMBER_OF_ALLOC_PHASES; ph++ )
+  {
+    printf(" %s %llu", allocationPhaseNames[ph], (unsigned long long) allocationCounts[ph]);
+  }
+  printf("\n");
+  if ( allocationCounts[ALLOC_RUN] > 0 )
+  {
+    printf("error: %llu allocations while the line ran\n", (unsigned long long) allocationCounts[ALLOC_RUN]);
+    return false;
+  }
+  return true;
+}
+#else
+inline void setAllocationPhase ( u8int /* phase */ )
+{
+}
+
+inline bool checkAllocations ()
+{
+  return true;
+}
+#endif
+
+// A small, self-contained random stream (splitmix64 to seed, xorshift64* to generate), so that each replica
+// of an ensemble can be given its own reproducible sequence, independent of which process or machine runs it.
+class RandomStream
+{
+private:
+  u64int state;
+  
+  static u64int mix ( u64int z )
+  {
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+  }
+  
+public:
+  
+  RandomStream ( u64int seed = 0, u64int stream = 0 )
+  {
+    setSeed ( seed, stream );
+  }
+  
+  void setSeed ( u64int seed, u64int stream )
+  {
+    // Mix the stream number in separately, so that neighbouring seeds and streams don't overlap.
+    state = mix ( mix ( seed + 0x9e3779b97f4a7c15ULL ) ^ stream );
+    if ( state == 0 )
+    {
+      state = 0x9e3779b97f4a7c15ULL; // xorshift must never hold an all-zero state
+    }
+  }
+  
+  u64int next ()
+  {
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 0x2545f4914f6cdd1dULL;
+  }
+  
+  probability nextProbability ()
+  {
+    // Use the top 24 bits, which is all the precision a float mantissa holds.
+    return ((probability) (next() >> 40)) / ((probability) (1 << 24));
+  }
+};
+
+// When set, getRandomNumber() draws from this stream rather than the C library.  Per thread, so each thread of an
+// ensemble can be running its own replica.
+static thread_local RandomStream *currentRandomStream = NULL;
+
+void setRandomStream ( RandomStream *rs )
+{
+  currentRandomStream = rs;
+}
+
 // Randomness helper function, must return a probability between 0.0 and 1.0
 probability getRandomNumber()
 {
   static int seeded = 0;
   probability p = (probability) 0.0;
   
+  if ( currentRandomStream != NULL )
+  {
+    return currentRandomStream->nextProbability();
+  }
+  
   if (seeded == 0)
   {
 #if defined (__APPLE__)
@@ -69,6 +285,147 @@ probability getRandomNumber()
   return (p);  
 }
 
+// Large allocations (belt slot arrays) can be backed by huge pages, to cut down on TLB misses for long belts.
+// Small allocations always come from malloc, a huge page for a 5 slot belt would be silly.
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+enum HugePageMode
+{
+  HUGE_PAGES_NONE,        // Plain malloc
+  HUGE_PAGES_TRANSPARENT, // mmap and ask the kernel to use transparent huge pages (madvise)
+  HUGE_PAGES_EXPLICIT     // mmap from the reserved hugetlbfs pool, falling back to transparent if it is empty
+};
+
+static HugePageMode hugePageMode = HUGE_PAGES_NONE;
+
+void setHugePageMode ( HugePageMode mode )
+{
+  hugePageMode = mode;
+}
+
+// Returns zero filled memory, setting *mapped if it came from mmap rather than malloc. NB: the memory is first
+// touched by the calling thread, so under Linux's default first-touch policy it lands on that thread's NUMA node.
+void *allocateLarge ( size_t bytes, bool *mapped )
+{
+  *mapped = false;
+  
+#if defined (__linux__)
+  if ( hugePageMode != HUGE_PAGES_NONE && bytes >= HUGE_PAGE_SIZE )
+  {
+    size_t rounded = (bytes + HUGE_PAGE_SIZE - 1) & ~((size_t) HUGE_PAGE_SIZE - 1);
+    void *p = MAP_FAILED;
+    
+    if ( hugePageMode == HUGE_PAGES_EXPLICIT )
+    {
+      p = mmap ( NULL, rounded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0 );
+    }
+    if ( p == MAP_FAILED )
+    {
+      p = mmap ( NULL, rounded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+      if ( p != MAP_FAILED )
+      {
+        madvise ( p, rounded, MADV_HUGEPAGE ); // Only advice, not having THP available is not an error
+      }
+    }
+    if ( p != MAP_FAILED )
+    {
+      *mapped = true;
+      return p;
+    }
+  }
+#endif
+  return calloc ( 1, bytes );
+}
+
+void freeLarge ( void *p, size_t bytes, bool mapped )
+{
+#if defined (__linux__)
+  if ( mapped )
+  {
+    munmap ( p, (bytes + HUGE_PAGE_SIZE - 1) & ~((size_t) HUGE_PAGE_SIZE - 1) );
+    return;
+  }
+#endif
+  free ( p );
+}
+
+// Bitsets, as arrays of 64 bit words, bit n of the set being bit (n % 64) of word (n / 64)
+#define BITS_PER_WORD 64
+#define BITSET_WORDS(n) (((n) + BITS_PER_WORD - 1) / BITS_PER_WORD)
+
+inline void setBit ( u64int *bits, u32int n )
+{
+  bits[n / BITS_PER_WORD] |= 1ULL << (n % BITS_PER_WORD);
+}
+
+inline void clearBit ( u64int *bits, u32int n )
+{
+  bits[n / BITS_PER_WORD] &= ~(1ULL << (n % BITS_PER_WORD));
+}
+
+inline bool testBit ( u64int *bits, u32int n )
+{
+  return ( bits[n / BITS_PER_WORD] >> (n % BITS_PER_WORD) ) & 1;
+}
+
+// Whether any of bits lo .. hi - 1 are set
+bool anyBitsInRange ( u64int *bits, u32int lo, u32int hi )
+{
+  while ( lo < hi )
+  {
+    u32int end = ( lo / BITS_PER_WORD + 1 ) * BITS_PER_WORD;
+    u32int top = ( hi < end ) ? hi : end;
+    u64int mask = ( top - lo == BITS_PER_WORD ) ? ~0ULL : ( ( 1ULL << (top - lo) ) - 1 ) << (lo % BITS_PER_WORD);
+    
+    if ( bits[lo / BITS_PER_WORD] & mask )
+    {
+      return true;
+    }
+    lo = top;
+  }
+  return false;
+}
+
+// Moves every bit of an n bit set up by "shift" places (to higher numbers), zero filling at the bottom and
+// dropping whatever goes past bit n - 1.
+void shiftBitsUp ( u64int *bits, u32int n, u32int shift )
+{
+  u32int words = BITSET_WORDS ( n );
+  u32int wordShift = shift / BITS_PER_WORD, bitShift = shift % BITS_PER_WORD;
+  
+  for ( int w = words - 1; w >= 0; w-- )
+  {
+    u64int hi = ( w >= (int) wordShift ) ? bits[w - wordShift] : 0;
+    u64int lo = ( w >= (int) wordShift + 1 ) ? bits[w - wordShift - 1] : 0;
+    bits[w] = ( bitShift == 0 ) ? hi : ( (hi << bitShift) | (lo >> (BITS_PER_WORD - bitShift)) );
+  }
+  if ( n % BITS_PER_WORD != 0 )
+  {
+    bits[words - 1] &= ( 1ULL << (n % BITS_PER_WORD) ) - 1;
+  }
+}
+
+// Rotates an n bit set up by "shift" places, the bits going past bit n - 1 coming round to the bottom
+void rotateBitsUp ( u64int *bits, u32int n, u32int shift )
+{
+  shift %= n;
+  
+  // A word's worth at a time, so the bits carried round fit in one word
+  while ( shift > 0 )
+  {
+    u32int s = ( shift > BITS_PER_WORD ) ? BITS_PER_WORD : shift;
+    u64int carried = 0;
+    
+    for ( u32int b = 0; b < s; b++ )
+    {
+      carried |= ((u64int) testBit ( bits, n - s + b )) << b;
+    }
+    shiftBitsUp ( bits, n, s );
+    bits[0] |= carried;
+    shift -= s;
+  }
+}
+
 class ItemType
 {
 private:
@@ -77,9 +434,12 @@ private:
   u32int weight;
   float generationProbability; // A classic probabilty number (0 = never, 1 = certainty) of whether this item
                               // will be generated in any given instance.
-  u32int numberCollected; // Records how many of this item were counted off the end of the belt
+  u64int numberCollected; // Records how many of this item were counted off the end of the belt
+  u64int numberRejected; // Records how many of this item couldn't get onto the belt (on a loop, where the entry
+                        // slot can still be full).
   ItemType **componentsRequired; // In the case where this a composite item, this is the NULL terminated array
                                 // of the components required to complete it.
+  u32int size; // Slots the item takes up on the belt (only finished items can be more than one, see Belt)
   
 public:
   ItemType *nextItemType;
@@ -91,8 +451,10 @@ public:
     name = '\0';
     nextItemType = NULL;
     numberCollected = 0;
+    numberRejected = 0;
     weight = 0;
     componentsRequired = NULL;
+    size = 1;
   }
   
   ItemType( ascii itemType )
@@ -102,7 +464,10 @@ public:
     name = itemType;
     nextItemType = NULL;
     numberCollected = 0;
+    numberRejected = 0;
     weight = 0;
+    componentsRequired = NULL;
+    size = 1;
   }
   
   ascii getName ()
@@ -115,6 +480,16 @@ public:
     return id;
   }
   
+  void setSize ( u32int slots )
+  {
+    size = ( slots > 0 ) ? slots : 1;
+  }
+  
+  u32int getSize ()
+  {
+    return size;
+  }
+  
   void setWeighting ( u32int w )
   {
     weight = w;
@@ -140,10 +515,25 @@ public:
     numberCollected++;
   }
   
-  u32int getNumberCollected()
+  void addNumberCollected ( u64int n )
+  {
+    numberCollected += n;
+  }
+  
+  u64int getNumberCollected()
   {
     return numberCollected;
   }
+  
+  void incrementNumberRejected()
+  {
+    numberRejected++;
+  }
+  
+  u64int getNumberRejected()
+  {
+    return numberRejected;
+  }
     
   void deleteNextItem()
   {
@@ -161,7 +551,36 @@ public:
   
   void setComponentsRequired (  ItemType **crqd )
   {
-    componentsRequired = crqd;
+    // Keep our own copy of the NULL terminated list, so the caller's array can go out of scope (which matters
+    // once lines are built by a helper function, one per replica).
+    u32int n = 0;
+    while ( crqd[n] != NULL )
+    {
+      n++;
+    }
+    
+    free ( componentsRequired );
+    componentsRequired = (ItemType **) malloc ( (n + 1) * sizeof(ItemType *) );
+    memcpy ( componentsRequired, crqd, (n + 1) * sizeof(ItemType *) );
+  }
+  
+  // The NULL terminated list of what goes into this (NULL for a component)
+  ItemType **getComponentsRequired ()
+  {
+    return componentsRequired;
+  }
+  
+  // Whether "it" is one of the components of this
+  bool needs ( ItemType *it )
+  {
+    for ( u32int x = 0; componentsRequired != NULL && componentsRequired[x] != NULL; x++ )
+    {
+      if ( componentsRequired[x]->getId() == it->getId() )
+      {
+        return true;
+      }
+    }
+    return false;
   }
   
   ItemType *assemble ( ItemType **componentsAvailable )
@@ -209,13 +628,50 @@ public:
   
   ~ItemType()
   {
-    // Nothing to be done to destruct yet.
+    free ( componentsRequired ); // Our copy of the required components list (free of NULL is fine)
   }
     
 };
 
+// Fills the slots behind the head of an item more than one slot long: an item of size k is its head, in the slot
+// at the front, followed by k - 1 of these, so it moves along with the rest of the belt.
+static ItemType continuationMarker ( '+' );
+
 #define ASSEMBLE_TIME 4 // It takes us four cycles to build, once we have the necessary pieces
 
+// ------ Observer hooks ------
+//
+// For custom metrics without touching the model: the line reports each state change to an observer class chosen
+// at compile time, through static member functions.  The default, NullObserver, does nothing in them, so the calls
+// inline to nothing and the hot paths cost what they did before.  To watch the line, write a class with the same
+// members (deriving from NullObserver, so only the events wanted need writing) in a header, and build with
+//   -DLINE_OBSERVER=MyObserver -DLINE_OBSERVER_HEADER='"myObserver.h"'
+// setting its "enabled" to true: the lane and station engines don't run the code the hooks are in, so they turn
+// down lines when an observer is built in.  The hooks are called on whichever thread is stepping the line, so an
+// observer used with --threads should keep its counts per thread (thread_local).
+
+class Worker;
+
+struct NullObserver
+{
+  static const bool enabled = false;
+  
+  static inline void onArrival ( ItemType * /* it */ ) {} // Put onto the belt, at the entry or by a side feeder
+  static inline void onPickup ( Worker * /* wk */, ItemType * /* it */ ) {}
+  static inline void onAssemblyStart ( Worker * /* wk */, ItemType * /* finished */ ) {}
+  static inline void onAssemblyFinish ( Worker * /* wk */, ItemType * /* finished */ ) {}
+  static inline void onPlacement ( Worker * /* wk */, ItemType * /* finished */ ) {} // The finished item put onto the belt
+  static inline void onExit ( ItemType * /* it */ ) {} // Collected, off the end or at a loop's output station
+};
+
+#ifdef LINE_OBSERVER_HEADER
+#include LINE_OBSERVER_HEADER
+#endif
+#ifndef LINE_OBSERVER
+#define LINE_OBSERVER NullObserver
+#endif
+typedef LINE_OBSERVER LineObserver;
+
 class Worker
 {
 private:
@@ -228,6 +684,10 @@ private:
   u32int amAssembling; // Zero indicates we are not assembling, a positive integer indicates how many cycles are left before the
                       // assembly is finished.
   ItemType *leftHand, *rightHand;
+  ItemType *product; // What we build, NULL for whatever the belt is making (the head of its finished items)
+  u32int assemblyTime; // Steps an assembly takes us
+  bool selective; // Only pick up what our product needs, and we aren't already holding
+  bool consuming; // Use up what we hold in an assembly (the challenge's workers keep it, and build again)
   
 public:
   Worker *nextWorker;
@@ -240,6 +700,10 @@ public:
     amAssembling = 0; 
     doneWork = false;
     leftHand = NULL, rightHand = NULL;
+    product = NULL;
+    assemblyTime = ASSEMBLE_TIME;
+    selective = false;
+    consuming = false;
   }
   
   void setPosition ( u32int p)
@@ -282,11 +746,61 @@ public:
     return doneWork;
   }
   
+  ItemType *getLeftHand ()
+  {
+    return leftHand;
+  }
+  
+  ItemType *getRightHand ()
+  {
+    return rightHand;
+  }
+  
+  // Steps left on the current assembly (0 when not assembling)
+  u32int getAssemblyLeft ()
+  {
+    return amAssembling;
+  }
+  
+  // Workers can differ from the challenge's (see buildSyntheticLine): building a product of their own, on a line
+  // making several, taking their own time over it, leaving alone the items they have no use for, and using up
+  // what goes into it.
+  void setProduct ( ItemType *fit )
+  {
+    product = fit;
+  }
+  
+  ItemType *getProduct ( ItemType *finishedProductsToBuild )
+  {
+    return ( product != NULL ) ? product : finishedProductsToBuild;
+  }
+  
+  void setAssemblyTime ( u32int t )
+  {
+    assemblyTime = ( t > 0 ) ? t : 1;
+  }
+  
+  void setSelective ( bool sel )
+  {
+    selective = sel;
+  }
+  
+  void setConsuming ( bool con )
+  {
+    consuming = con;
+  }
+  
+  // Whether we work just as the challenge's workers do, which is all the lane and station engines know how to model
+  bool isPlain ()
+  {
+    return product == NULL && assemblyTime == ASSEMBLE_TIME && !selective && !consuming;
+  }
+  
   // GK: TODO, this function is oversimplified currently, dealing with only one finished item and two hands. 
   ItemType *doWork ( ItemType *it /* New item offered */, ItemType *finishedProductsToBuild /* Things we are trying to make */ )
   {
     ItemType *out = it; // out is what we "return" to the belt
-    ItemType *finishedThing = finishedProductsToBuild; // GK: Bodge, I was running out of time, take the head of the list.
+    ItemType *finishedThing = getProduct ( finishedProductsToBuild ); // GK: Bodge, I was running out of time, take the head of the list.
     
     // First mark ourselves as having done work (or at least attempted it).
     doneWork = true;
@@ -300,13 +814,16 @@ public:
       if (amAssembling == 0)
       {
         out = finishedThing;
+        LINE_PROBE2 ( assembly_finish, this, finishedThing->getName() );
+        LineObserver::onAssemblyFinish ( this, finishedThing );
+        LineObserver::onPlacement ( this, finishedThing );
       }
       
       return out;
     }
     
-    // Is the belt slot empty ?
-    if (!(it == NULL || it->getId() == NULL_ITEM_ID)) // There can be two sorts of empty slot
+    // Is the belt slot empty ? (or, for a selective worker, holding nothing we want)
+    if (!(it == NULL || it->getId() == NULL_ITEM_ID) && !( selective && !finishedThing->needs ( it ) )) // There can be two sorts of empty slot
     {
       // Slot has contents, so do we have an empty hand to put "it" in ?
       if ( leftHand == NULL)
@@ -317,6 +834,8 @@ public:
           // Put the it in our left hand
           leftHand = it;
           out = NULL; // As it stands currently, we have emptied the slot
+          LINE_PROBE2 ( pickup, this, it->getName() );
+          LineObserver::onPickup ( this, it );
         }
       }
       if ( rightHand == NULL)
@@ -327,6 +846,8 @@ public:
           // Put the it in our right hand
           rightHand = it;
           out = NULL; // As it stands currently, we have emptied the slot
+          LINE_PROBE2 ( pickup, this, it->getName() );
+          LineObserver::onPickup ( this, it );
         }
       }
     }
@@ -339,13 +860,41 @@ public:
       if (finishedThing->assemble (hands) != NULL)
       {
         // Start assembling.
-        amAssembling = ASSEMBLE_TIME; // GK: TODO, make this flexible
+        amAssembling = assemblyTime;
+        if ( consuming )
+        {
+          leftHand = NULL, rightHand = NULL;
+        }
+        LINE_PROBE2 ( assembly_start, this, finishedThing->getName() );
+        LineObserver::onAssemblyStart ( this, finishedThing );
       }
     }
       
     return out;
   }
   
+  // Whether doWork() would do anything if offered an empty slot: true while assembling, or when holding what's needed
+  // to start. A worker who isn't ready, at an empty slot, can be skipped.
+  bool isReadyToAct ( ItemType *finishedProductsToBuild )
+  {
+    if ( amAssembling > 0 )
+    {
+      return true;
+    }
+    if ( leftHand == NULL || rightHand == NULL )
+    {
+      return false;
+    }
+    ItemType *hands[] = { leftHand, rightHand, NULL };
+    return getProduct ( finishedProductsToBuild )->assemble ( hands ) != NULL;
+  }
+  
+  // Whether our next turn finishes an assembly, and places the finished item
+  bool isAboutToFinish ()
+  {
+    return amAssembling == 1;
+  }
+  
   void deleteNextWorker()
   {
     if ( nextWorker != NULL )
@@ -355,421 +904,6207 @@ public:
       {
         nextWorker->deleteNextWorker();
       }        
+      // By now, the others will have been deleted, so delete the neighbour.
+      delete nextWorker;
     }
   }
 };
 
-class Belt
+// How many of "count" things per "period" steps happen on step "step", spread as evenly as whole things allow (so 3
+// per 2 steps goes 1, 2, 1, 2 ...), and how many happen over the k steps from "step" on.
+// Worked in 128 bits, so long runs (of steps times count past 2^64) don't overflow.
+u32int scheduledCount ( u64int step, u32int count, u32int period )
+{
+  return (u32int) ( ( (u128int) (step + 1) * count ) / period - ( (u128int) step * count ) / period );
+}
+
+u64int scheduledTotal ( u64int step, u64int k, u32int count, u32int period )
+{
+  return (u64int) ( ( (u128int) (step + k) * count ) / period - ( (u128int) step * count ) / period );
+}
+
+// A side feeder, putting items onto the belt partway down, at its own slot.  Each time the belt moves on a slot, an
+// item arrives with probability "rate", drawn from the feeder's own mix of item types (by weight).  The item types
+// must be ones the belt makes (see Belt::addItemFactory), so they are counted, and deleted, along with the rest.
+// The arrivals are drawn FEEDER_BLOCK moves at a time, from the feeder's own random stream, so the step itself just
+// takes the next one from the block.
+
+#define FEEDER_BLOCK 64
+#define MAX_FEEDER_ITEMS 16
+
+class Feeder
 {
 private:
-	u32int numberOfSlots;
-  Worker *workers;
-  ItemType *itemsToMake;
-  ItemType *finishedItems;
-  u64int totalItemWeighting;
-  u64int totalWorkerWeighting;
-  probability currentWorkerMaxProbability; // Starts off at 1.0 and is reduced to match the workers yet to work in the current interval
-  ItemType **beltSlots;
+  u32int position;
+  probability rate;
+  u32int numberOfItems;
+  ItemType *mixItems[MAX_FEEDER_ITEMS];
+  u32int mixWeights[MAX_FEEDER_ITEMS];
+  u32int totalWeighting;
+  RandomStream stream;
+  bool seeded;
+  ItemType *arrivals[FEEDER_BLOCK]; // The next block of arrivals, NULL for none
+  u32int nextArrival;
   
-public:
-    
-  Belt(int slots = 3)
+  // Draws the next block of arrivals.  The feeder's stream is seeded from the line's (or the C library) on first
+  // use, so each replica's feeders get their own streams, and the line's draws don't depend on the feeders'.
+  void refill ()
   {
-    workers = NULL;
-    itemsToMake = NULL;
-    totalItemWeighting = 0;
-    totalWorkerWeighting =0;      
-    numberOfSlots = slots;
-    currentWorkerMaxProbability = 1.0;
-
-    // GK: Use malloc here because I don't want to call the destructor on the items in the slots upon deletion
-    beltSlots = (ItemType** ) malloc (slots * sizeof(ItemType));
+    if ( !seeded )
+    {
+      stream.setSeed ( ( currentRandomStream != NULL ) ? currentRandomStream->next() : (u64int) random(), position );
+      seeded = true;
+    }
     
-    for (int i = 0; i < slots; i++)
+    for ( u32int k = 0; k < FEEDER_BLOCK; k++ )
     {
-      beltSlots[i]= NULL ; // Fill the slots with the NULL pointer for now.
+      arrivals[k] = NULL;
+      if ( stream.nextProbability() < rate && totalWeighting > 0 )
+      {
+        u32int pick = (u32int) ( stream.next() % totalWeighting ), i = 0;
+        
+        while ( pick >= mixWeights[i] )
+        {
+          pick -= mixWeights[i++];
+        }
+        arrivals[k] = mixItems[i];
+      }
     }
+    nextArrival = 0;
   }
   
-  void addWorker( Worker *newWorker, u32int position, u32int weighting = 50 /* Even, middle of the road weighting by default */)
+public:
+  
+  Feeder ( u32int pos, probability r )
   {
-    // Add the new worker to the start of the worker list (simpler and faster than finding the end)
-    Worker *oldHead = workers;
-    
-    workers = newWorker; // the newWorker is the head of the worker list
-    newWorker->nextWorker = oldHead; // attach the other workers onto the new one.
-    
-    newWorker->setPosition(position);
+    position = pos;
+    rate = r;
+    numberOfItems = 0;
+    totalWeighting = 0;
+    seeded = false;
+    nextArrival = FEEDER_BLOCK; // Nothing drawn yet
+  }
   
-    // Remember its weighting in the object
-    newWorker->setWeighting ( weighting );
-    
-    // Keep a record of the total weight (so relative probabilities can be calculated ).
-    totalWorkerWeighting += weighting;
-    
-    // Recalculate the item type probabilities
-    Worker *wk = workers;
-    
-    while ( wk != NULL )
+  bool addItem ( ItemType *it, u32int weighting )
+  {
+    if ( numberOfItems == MAX_FEEDER_ITEMS )
     {
-      probability p; // Probability for this item type to be generated in any given iteration
-      
-      p =  ((probability) wk->getWeighting() ) / ((probability) totalWorkerWeighting);
-      wk->setWorkProbability (p);
-      DEBUG("Probability of worker %p working = %f\n", wk, wk->getWorkProbability());
-      
-      wk = wk->nextWorker;
+      return false;
     }
-    // Recalculating the probabilities is based on a max of 1.0
-    currentWorkerMaxProbability = 1.0;
+    mixItems[numberOfItems] = it;
+    mixWeights[numberOfItems++] = weighting;
+    totalWeighting += weighting;
+    return true;
+  }
   
+  u32int getPosition ()
+  {
+    return position;
   }
-
-  void addItemFactory ( ItemType *newType, u32int weighting )
+  
+  // What arrives at the feeder with this slot move (NULL for nothing)
+  ItemType *getNextArrival ()
   {
-    ItemType *oldHead = itemsToMake;
-    
-    // Add the new item factory to the head of the list.
-    itemsToMake = newType;
-    newType->nextItemType = oldHead;
-    
-    // Remember its weighting in the object
-    newType->setWeighting ( weighting );
-    
-    // Keep a record of the total weight (so relative probabilities can be calculated ).
-    totalItemWeighting += weighting;
-    
-    // Recalculate the item type probabilities
-    ItemType *it = itemsToMake;
-    
-    while ( it != NULL )
+    if ( nextArrival == FEEDER_BLOCK )
     {
-      probability p; // Probability for this item type to be generated in any given iteration
-      
-      p =  ((probability) it->getWeighting() ) / ((probability) totalItemWeighting);
-      it->setGenerationProbability (p);
-      
-      it = it->nextItemType;
+      refill();
     }
+    return arrivals[nextArrival++];
   }
+};
 
-  void addFinishedItem ( ItemType *fit)
+// What the belt does when the output end is blocked
+enum SinkBlocking
+{
+  SINK_STOP, // The whole belt stops (and nothing arrives) until the sink has room
+  SINK_SLIP  // The belt slips under the blocked items: items close up behind them, and arrivals get on if there's room
+};
+
+// Where finished work goes off the end of a straight belt (packing, say): it holds a limited number of items, and
+// takes them away at a fixed rate, "serviceItems" every "serviceSteps" steps.  When it is full, the item in the last
+// slot can't leave, and the belt is blocked.  Empty slots never block.
+class OutputSink
+{
+private:
+  u32int capacity;
+  u32int held;
+  u32int serviceItems, serviceSteps;
+  SinkBlocking blocking;
+  u64int numberServed; // Items taken away
+  u64int blockedMoves; // Slot moves the belt couldn't make because the sink was full
+  
+public:
+  
+  OutputSink ( u32int cap, u32int items, u32int steps, SinkBlocking b = SINK_STOP )
   {
-    ItemType *oldHead = finishedItems;
-    
-    // Add the new finished item type to the head of the list.
-    finishedItems = fit;
-    fit->nextItemType = oldHead;
+    capacity = cap;
+    held = 0;
+    serviceItems = items;
+    serviceSteps = ( steps > 0 ) ? steps : 1;
+    blocking = b;
+    numberServed = 0;
+    blockedMoves = 0;
   }
   
-  ItemType *getFinishedItems ()
+  bool isFull ()
   {
-    return finishedItems;
+    return held >= capacity;
   }
   
-  ItemType *getNextItem()
+  void accept ()
   {
-    // We select the next item randomly but according to probability weight
-    // this is done by laying out the itemTypes across the probability space between 0.0 and 1.0
-    // The total probabilities should already add up to 1.0 as they are calculated afresh as each
-    // item type is added.
-    probability p = getRandomNumber ();
-    probability cumulative = (probability) 0.0;
-    
-    ItemType *it = itemsToMake;
-    while ( it != NULL )
-    {
-      cumulative += it->getGenerationProbability();
-      if ( p <= cumulative )
-      {
-        return it;
-      }
-      it = it->nextItemType;
-    }
-    printf ("Eeek, probability p (%f) did not hit any items in the probability space.\n",p);
-    
-    return NULL;
+    held++;
   }
   
-  Worker *getNextWorker()
+  // Takes away this step's share of the items
+  void serve ( u64int step )
   {
-    // We select the next worker to act in any given instance randomly from the list of workers
-    // taking into account probability weighting, much as with the items.
-    // Once a worker has been selected, they are marked as such and removed from the probability
-    // pool, until the last worker has 100% probabilty of being next. Advancing the belt resets
-    // all workers to the unselected state.
+    u32int n = scheduledCount ( step, serviceItems, serviceSteps );
     
-    probability p = getRandomNumber ();
-    probability cumulative = (probability) 0.0;
-    
-    // Adjust p by the maximum probability space (so for instance, if the first worker in this instance
-    // (with a 0.2 probability)  has done work, the maximum space is now 0.8
-    p = p * currentWorkerMaxProbability;
+    n = ( n < held ) ? n : held;
+    held -= n;
+    numberServed += n;
+  }
+  
+  // Takes away the share of k steps from "step" on, with nothing arriving meanwhile
+  void serveSteps ( u64int step, u64int k )
+  {
+    u64int n = scheduledTotal ( step, k, serviceItems, serviceSteps );
     
-    Worker *wk = workers;
-    while ( wk != NULL )
+    n = ( n < held ) ? n : held;
+    held -= n;
+    numberServed += n;
+  }
+  
+  // How many steps from "step" on take nothing away (at most "limit")
+  u64int getStepsUntilService ( u64int step, u64int limit )
+  {
+    if ( serviceItems == 0 )
     {
-      if (wk->getHasDoneWork() == true)
-      {
-        // This worker has already done work, so skip
-        wk = wk->nextWorker;
-        continue;
-      }
-      
-      cumulative += wk->getWorkProbability();
-      if ( p <= cumulative )
-      {
-        // p fell into the bucket for this worker, so select, recalcuate the max probability space for everyone else
-        // and return.
-        
-        // Adjust the probability space.
-        currentWorkerMaxProbability -= wk->getWorkProbability();
-        
-        return wk;
-      }
-      wk = wk->nextWorker;
+      return limit;
     }
-    printf ("Eeek, probability p (%f) did not hit any items in the probability space.\n",p);
     
-    return NULL;
+    // The first step s with something to take is the first where the running total passes what it was at "step"
+    u128int before = ( (u128int) step * serviceItems ) / serviceSteps;
+    u64int first = (u64int) ( ( (before + 1) * serviceSteps + serviceItems - 1 ) / serviceItems - 1 );
+    u64int idle = ( first > step ) ? first - step : 0;
+    
+    return ( idle < limit ) ? idle : limit;
   }
   
-  void setSlot ( ItemType *itemType, u32int slot )
+  SinkBlocking getBlocking ()
   {
-    beltSlots[slot] = itemType;
+    return blocking;
   }
   
-  ItemType *getSlot ( u32int slot )
+  void countBlocked ( u64int moves )
   {
-    return beltSlots[slot];
+    blockedMoves += moves;
   }
-
-  void advanceBelt ( int n )
+  
+  u64int getNumberServed ()
   {
-    // Move the "belt" along by n slots, new slots are zero'd, items coming off the belt are counted by type
-    // Also resets the workers along the belt into their unselected state.
-    
-    // First, take the n last slots off the belt and count any items
-    u32int lastSlot = (numberOfSlots - 1); /* Zero based array */
-    for (int i = lastSlot; i > (lastSlot - n); i--)
-    {
-      ItemType *it = beltSlots[i];
-      
-      if ( it != NULL )
-      {
-        it->incrementNumberCollected();
-      }
-    }
-    
-    // Now move all the pointers down n slots
-    for (int i = numberOfSlots; i > 0; i--)
-    {
-      // Determine whether we are at least n slots from the start of the belt
-      // this avoids copying from negative slot positions, which is a nonsense.
-      if ( i >= n )
-      {
-        // Copy the pointers from the adjacent slots        
-        beltSlots[i] = beltSlots[i-n];
-      }
-      else
-      {
-        // We need to zero-fill at the start of the belt
-        beltSlots[i] = NULL;
-      }
-    }
-    
-    // Now reset the worker probability space
-    currentWorkerMaxProbability = 1.0;
-    
-    // Also reset the workers to not having done work
-    Worker *wk = workers;
-    
-    while ( wk != NULL )
-    {
-      wk->setHasDoneWork (false);
-      wk = wk->nextWorker;
-    }
-    
+    return numberServed;
   }
   
-  void printItemFactoryCounts ()
+  u64int getBlockedMoves ()
   {
-    ItemType *it = itemsToMake;
-    
-    while ( it != NULL )
-    {
-      printf("Item \"%c\", was collected off the belt %d times\n", it->getName(), it->getNumberCollected());
-      
-      it = it->nextItemType;
-    }
+    return blockedMoves;
   }
+};
 
-  void printFinishedItemCounts ()
+// When something (the belt, or a station) is broken down: it runs for a time between failures, then is down for a
+// time to repair, and so on, both geometric with the given means, in steps.  The down intervals are sampled
+// BREAKDOWN_BLOCK at a time, from the schedule's own random stream, into a sorted list which the line walks along as
+// the steps go by, so there's no failure die to roll each step.
+
+#define BREAKDOWN_BLOCK 32
+
+class BreakdownSchedule
+{
+private:
+  u32int meanBetween, meanRepair;
+  RandomStream stream;
+  u64int downStart[BREAKDOWN_BLOCK], downEnd[BREAKDOWN_BLOCK]; // Down for steps [start, end)
+  u32int current; // The first interval not yet over
+  u64int sampledUntil; // The end of the last interval sampled
+  u64int failuresPassed; // Intervals over and done with
+  
+  // A geometric number of steps (at least 1) with the given mean
+  u64int sampleSteps ( u32int mean )
   {
-    ItemType *it = finishedItems;
-    
-    while ( it != NULL )
+    if ( mean <= 1 )
     {
-      printf("Item \"%c\", was collected off the belt %d times\n", it->getName(), it->getNumberCollected());
-      
-      it = it->nextItemType;
+      return 1;
     }
+    double u = stream.nextProbability();
+    return 1 + (u64int) floor ( log ( 1.0 - u ) / log ( 1.0 - 1.0 / mean ) );
   }
   
-  ~Belt()
+  void sampleBlock ()
   {
-    // We get each worker in the list to recurse and delete its neighbour, then we delete the final one.
-    if ( workers != NULL )
+    for ( u32int k = 0; k < BREAKDOWN_BLOCK; k++ )
     {
-      workers->deleteNextWorker();
-      delete workers;
+      downStart[k] = sampledUntil + sampleSteps ( meanBetween );
+      downEnd[k] = downStart[k] + sampleSteps ( meanRepair );
+      sampledUntil = downEnd[k];
     }
-    
-    // We get each item in the list to recurse and delete its neighbour, then we delete the final one.
-    if ( itemsToMake != NULL )
+    current = 0;
+  }
+  
+  // Moves along to "step" (steps never go backwards)
+  void advance ( u64int step )
+  {
+    while ( step >= downEnd[current] )
     {
-      itemsToMake->deleteNextItem();
-      delete itemsToMake;
+      failuresPassed++;
+      if ( ++current == BREAKDOWN_BLOCK )
+      {
+        sampleBlock();
+      }
     }
-    
-    free (beltSlots); // Use free here to match the malloc
   }
+  
+public:
+  
+  BreakdownSchedule ( u32int between, u32int repair )
+  {
+    meanBetween = between;
+    meanRepair = repair;
+    sampledUntil = 0;
+    failuresPassed = 0;
+    current = 0;
+  }
+  
+  // Seeds the schedule and samples its first failures (made apart from the schedule itself, so the seed can come
+  // from the replica's stream on the first step without anything being allocated then)
+  void start ( u64int seed, u64int streamNumber )
+  {
+    stream.setSeed ( seed, streamNumber );
+    sampledUntil = 0;
+    failuresPassed = 0;
+    sampleBlock();
+  }
+  
+  bool isDown ( u64int step )
+  {
+    advance ( step );
+    return step >= downStart[current];
+  }
+  
+  // The next step at which isDown() changes
+  u64int getNextChange ( u64int step )
+  {
+    advance ( step );
+    return ( step >= downStart[current] ) ? downEnd[current] : downStart[current];
+  }
+  
+  // Failures up to and including "step"
+  u64int getFailures ( u64int step )
+  {
+    advance ( step );
+    return failuresPassed + ( step >= downStart[current] );
+  }
+};
 
+// The items on a stretch of belt with nobody working on it, in the order they come off the end of the stretch, each
+// with the step it gets there.  A ring of entries, doubled in size when it fills up, so it only ever holds about as
+// many entries as there are items on the stretch, however long the stretch is.
+struct DelayEntry
+{
+  ItemType *item;
+  u64int reaches;
 };
 
-class ProductionLine
+class DelayQueue
 {
 private:
-
-  Belt *belt;
+  DelayEntry *entries;
+  u32int capacity; // A power of two (or 0)
+  u32int first;
+  u32int count;
+  
+  void grow ( u32int bigger )
+  {
+    DelayEntry *moved = (DelayEntry *) malloc ( bigger * sizeof(DelayEntry) );
+    
+    for ( u32int i = 0; i < count; i++ )
+    {
+      moved[i] = entries[(first + i) & (capacity - 1)];
+    }
+    free ( entries );
+    entries = moved;
+    capacity = bigger;
+    first = 0;
+  }
+  
 public:
   
-  ProductionLine()
+  DelayQueue ()
   {
-    belt = NULL;
+    entries = NULL;
+    capacity = 0;
+    first = 0;
+    count = 0;
   }
   
-  void addBelt ( Belt *b)
+  ~DelayQueue ()
   {
-    belt = b;
+    free ( entries );
   }
   
-  ~ProductionLine()
+  // Room for "n" items without growing, so the run itself needn't allocate
+  void reserve ( u32int n )
   {
-    if ( belt != NULL )
+    u32int bigger = 16;
+    while ( bigger < n )
     {
-      delete belt;
+      bigger *= 2;
+    }
+    if ( bigger > capacity )
+    {
+      grow ( bigger );
     }
   }
   
-  void runSim ( u32int steps)
+  void push ( ItemType *it, u64int reaches )
   {
-     
-    for (int i = 0; i < steps; i++)
+    if ( count == capacity )
     {
-   
-      // Get the next item to place on the belt
-      ItemType *next = belt->getNextItem();
-      if (next == NULL )
-      {
-        printf("error: getNextItem failed to produce anything\n");
-        return;
-      }
-      DEBUG("Next item is \"%c\".\n", next->getName()); 
-   
-      // Advance the belt (and count things coming off the end)
-      belt->advanceBelt( 1 /* one step */);
-      
-      // Insert the new item into the entry slot
-      belt->setSlot( next, 0 /* slot zero - entry slot */);
-      
-      // Now prod each worker into doing work 
-      
-      Worker *wk = belt->getNextWorker();
-      
-      // Find out which position this worker is at and return the contents of that slot
-      u32int workerPosition = wk->getPosition();
-      ItemType *it = belt->getSlot( workerPosition );
-      ItemType *newIt = wk->doWork ( it, belt->getFinishedItems() );
-      
-      // Offer the item to the worker, worker returns the new contents of the slot ( which may be the same thing we gave them )
-      belt->setSlot ( newIt, workerPosition );
-      
+      grow ( ( capacity == 0 ) ? 16 : capacity * 2 );
     }
-    
+    DelayEntry *e = &entries[(first + count++) & (capacity - 1)];
+    e->item = it;
+    e->reaches = reaches;
   }
   
-  void printResults()
+  // The item reaching the end of the stretch by "step" (taking it off the stretch), or NULL if there isn't one
+  ItemType *popBy ( u64int step )
   {
-    belt->printItemFactoryCounts();
-    
+    if ( count == 0 || entries[first].reaches > step )
+    {
+      return NULL;
+    }
+    ItemType *it = entries[first].item;
+    first = (first + 1) & (capacity - 1);
+    count--;
+    return it;
+  }
+  
+  u32int getCount ()
+  {
+    return count;
+  }
+};
+
+// Cheap per-station counts, kept as the stations work and cleared each time the floaters are reconsidered
+struct StationCounters
+{
+  u32int offered; // Turns with an item in the slot
+  u32int missed; // Of those, turns which left the item there, as nobody could take it (a blocked station)
+};
+
+// Decides where a floating worker at station "current" should go, from the counters since the last decision.
+// Returns the station to move to, or -1 (or current) to stay put.
+typedef int (*ReassignPolicy) ( StationCounters *counters, u32int numberOfStations, u32int current );
+
+// Go where the most items are being missed, if that is more than here
+int reassignToBlocked ( StationCounters *counters, u32int numberOfStations, u32int current )
+{
+  int best = -1;
+  u32int most = counters[current].missed;
+  
+  for ( u32int s = 0; s < numberOfStations; s++ )
+  {
+    if ( counters[s].missed > most )
+    {
+      most = counters[s].missed;
+      best = s;
+    }
+  }
+  return best;
+}
+
+// Leave a station which was offered nothing, for the one offered the most
+int reassignFromStarved ( StationCounters *counters, u32int numberOfStations, u32int current )
+{
+  int best = -1;
+  u32int most = 0;
+  
+  if ( counters[current].offered > 0 )
+  {
+    return -1;
+  }
+  for ( u32int s = 0; s < numberOfStations; s++ )
+  {
+    if ( counters[s].offered > most )
+    {
+      most = counters[s].offered;
+      best = s;
+    }
+  }
+  return best;
+}
+
+// A worker who can move between stations.  While moving, they are at no station, and take no turns.
+struct Floater
+{
+  Worker *worker;
+  u32int index; // Into the belt's workerTable (found when the stations are built)
+  u32int station; // Where they are, or are going
+  u64int arrives; // The floater clock tick they get there, while moving
+  bool moving;
+};
+
+class Belt
+{
+private:
+	u32int numberOfSlots;
+  Worker *workers;
+  ItemType *itemsToMake;
+  ItemType *finishedItems;
+  u64int totalItemWeighting;
+  u64int totalWorkerWeighting;
+  ItemType **beltSlots; // A ring: slot i is at beltSlots[(ringStart + i) % numberOfSlots] (NULL when compressed)
+  bool beltSlotsMapped; // Whether beltSlots came from allocateLarge()'s mmap path
+  u32int ringStart;
+  bool loop; // Items going off the end come round to the start again, rather than being counted off
+  int outputSlot; // On a loop, finished items are taken off the belt as they pass this slot (-1 for nowhere)
+  u32int speedSlots, speedSteps; // The belt moves speedSlots slots every speedSteps steps, spread evenly
+  OutputSink *sink; // Where items off the end of a straight belt go (NULL for nowhere, they are just counted)
+  Feeder **feeders; // Side feeders, in the order added
+  u32int numberOfFeeders;
+  Floater *floaters; // Floating workers (also in the worker list), and how they decide to move
+  u32int numberOfFloaters;
+  ReassignPolicy reassignPolicy;
+  u32int reassignInterval; // Steps between decisions
+  u32int moveCost; // Steps a move takes
+  u64int floaterClock; // Steps so far, as counted by updateFloaters()
+  u64int numberOfMoves;
+  StationCounters *stationCounters; // By station
+  u32int stationEntries; // Workers in the station index (those not moving)
+  u32int beltBetween, beltRepair; // Mean steps between breakdowns and to repair, for the belt (0 for no breakdowns)
+  u32int stationBetween, stationRepair; // and each station
+  bool breakdownsStarted; // The schedules are seeded on the first step, so they draw from the replica's stream
+  BreakdownSchedule *beltBreakdowns;
+  BreakdownSchedule **stationBreakdowns; // By station
+  u64int *brokenSlots; // The stations broken down, by slot
+  u64int nextStationChange; // The next step any station breaks down or is repaired
+  u64int lastBreakdownStep;
+  // A compressed belt keeps no slots, only the items in flight on the stretches between stations: stretch 0 runs
+  // from the entry to station 0, stretch s from station s - 1 to station s, and the last one off the end, each
+  // taking stretchDelay[s] steps to travel (see stepCompressed).
+  bool compressed;
+  DelayQueue *stretches;
+  u32int *stretchDelay;
+  bool stuck; // The sink is full, and the last blocked move changed nothing (see ProductionLine::blockedSlot)
+  bool slotChanged; // Whether workStations() changed any slot
+  u32int numberOfWorkers;
+  Worker **workerTable; // The workers again, as an array (in list order), along with their positions, so the
+  u32int *workerPositions; // state a step will touch can be found without chasing the list.
+  bool everyWorker; // Every worker gets a turn each step, not just one drawn at random (see setEveryWorker)
+  
+  // Which slots hold something (not NULL, or the null item), shifted along with the belt, and which workers are
+  // ready to act regardless of their slot (see Worker::isReadyToAct).  Only a slot with workers and either an item
+  // or a ready worker has anything to do in a step, so the step can skip straight to those, a word at a time.
+  u64int *occupiedSlots;
+  u64int *staffedSlots; // Slots with at least one worker
+  u64int *readyWorkers; // By index into workerTable
+  u64int *activeSlots; // Scratch for each step: staffed and (occupied or with a ready worker)
+  
+  // The slot to worker index, compressed to just the staffed slots ("stations"), in slot order. Station s is at
+  // stationSlot[s], with workers stationWorkers[stationFirst[s]] .. [stationFirst[s + 1] - 1] (in list order) and
+  // their work probabilities alongside in stationWeights. A slot's station number is its rank among the staffed
+  // slots: the stations in earlier bitset words (staffedRank) plus those below it in its own word.
+  u32int numberOfStations;
+  u32int *stationSlot;
+  u32int *stationFirst;
+  u32int *stationWorkers;
+  probability *stationWeights;
+  u32int *staffedRank;
+  u32int *turnPicks; // Scratch for the order a station's workers act in
+
+  bool stationsBuilt; // Cleared when a worker is added
+  
+public:
+    
+  Belt(int slots = 3, bool compress = false)
+  {
+    workers = NULL;
+    itemsToMake = NULL;
+    finishedItems = NULL;
+    totalItemWeighting = 0;
+    totalWorkerWeighting =0;      
+    numberOfSlots = slots;
+    numberOfWorkers = 0;
+    workerTable = NULL;
+    workerPositions = NULL;
+    everyWorker = false;
+    occupiedSlots = (u64int *) calloc ( BITSET_WORDS ( slots ), sizeof(u64int) );
+    staffedSlots = (u64int *) calloc ( BITSET_WORDS ( slots ), sizeof(u64int) );
+    activeSlots = (u64int *) calloc ( BITSET_WORDS ( slots ), sizeof(u64int) );
+    staffedRank = (u32int *) calloc ( BITSET_WORDS ( slots ), sizeof(u32int) );
+    readyWorkers = NULL;
+    numberOfStations = 0;
+    stationSlot = NULL;
+    stationFirst = NULL;
+    stationWorkers = NULL;
+    stationWeights = NULL;
+    turnPicks = NULL;
+    stationsBuilt = false;
+
+    // GK: Use malloc here because I don't want to call the destructor on the items in the slots upon deletion
+    // Long belts may be backed by huge pages.  A compressed belt has no slots to store.
+    compressed = compress;
+    stretches = NULL;
+    stretchDelay = NULL;
+    beltSlots = compressed ? NULL : (ItemType** ) allocateLarge (slots * sizeof(ItemType *), &beltSlotsMapped);
+    ringStart = 0;
+    loop = false;
+    outputSlot = -1;
+    speedSlots = 1;
+    speedSteps = 1;
+    sink = NULL;
+    feeders = NULL;
+    numberOfFeeders = 0;
+    floaters = NULL;
+    numberOfFloaters = 0;
+    reassignPolicy = reassignToBlocked;
+    reassignInterval = 10;
+    moveCost = 0;
+    floaterClock = 0;
+    numberOfMoves = 0;
+    stationCounters = NULL;
+    stationEntries = 0;
+    beltBetween = beltRepair = stationBetween = stationRepair = 0;
+    breakdownsStarted = false;
+    beltBreakdowns = NULL;
+    stationBreakdowns = NULL;
+    brokenSlots = (u64int *) calloc ( BITSET_WORDS ( slots ), sizeof(u64int) );
+    nextStationChange = 0;
+    lastBreakdownStep = 0;
+    stuck = false;
+    slotChanged = false;
+    
+    for (int i = 0; !compressed && i < slots; i++)
+    {
+      beltSlots[i]= NULL ; // Fill the slots with the NULL pointer for now.
+    }
+  }
+  
+  void addWorker( Worker *newWorker, u32int position, u32int weighting = 50 /* Even, middle of the road weighting by default */)
+  {
+    // Add the new worker to the start of the worker list (simpler and faster than finding the end)
+    Worker *oldHead = workers;
+    
+    workers = newWorker; // the newWorker is the head of the worker list
+    newWorker->nextWorker = oldHead; // attach the other workers onto the new one.
+    
+    newWorker->setPosition(position);
+    
+    // Keep the worker table in list order (newest first) too
+    numberOfWorkers++;
+    workerTable = (Worker **) realloc ( workerTable, numberOfWorkers * sizeof(Worker *) );
+    workerPositions = (u32int *) realloc ( workerPositions, numberOfWorkers * sizeof(u32int) );
+    memmove ( &workerTable[1], &workerTable[0], (numberOfWorkers - 1) * sizeof(Worker *) );
+    memmove ( &workerPositions[1], &workerPositions[0], (numberOfWorkers - 1) * sizeof(u32int) );
+    workerTable[0] = newWorker;
+    workerPositions[0] = position;
+  
+    // Remember its weighting in the object
+    newWorker->setWeighting ( weighting );
+    
+    // Keep a record of the total weight (so relative probabilities can be calculated ).
+    totalWorkerWeighting += weighting;
+    
+    // Recalculate the item type probabilities
+    Worker *wk = workers;
+    
+    while ( wk != NULL )
+    {
+      probability p; // Probability for this item type to be generated in any given iteration
+      
+      p =  ((probability) wk->getWeighting() ) / ((probability) totalWorkerWeighting);
+      wk->setWorkProbability (p);
+      DEBUG("Probability of worker %p working = %f\n", wk, wk->getWorkProbability());
+      
+      wk = wk->nextWorker;
+    }
+    
+    stationsBuilt = false; // The slot to worker index needs rebuilding
+  }
+
+  // Adds a floating worker, starting at "position", who the belt moves between its stations as "policy" decides, every
+  // "interval" steps, each move taking "cost" steps. Every floater shares the last policy, interval and cost given.
+  // Floaters only move between stations, the slots with workers when the belt starts.
+  void addFloater ( Worker *newWorker, u32int position, ReassignPolicy policy, u32int interval, u32int cost,
+                    u32int weighting = 50 )
+  {
+    addWorker ( newWorker, position, weighting );
+    
+    floaters = (Floater *) realloc ( floaters, (numberOfFloaters + 1) * sizeof(Floater) );
+    floaters[numberOfFloaters].worker = newWorker;
+    floaters[numberOfFloaters].moving = false;
+    numberOfFloaters++;
+    reassignPolicy = policy;
+    reassignInterval = ( interval > 0 ) ? interval : 1;
+    moveCost = cost;
+  }
+  
+  u32int getNumberOfFloaters ()
+  {
+    return numberOfFloaters;
+  }
+  
+  // Whether every worker works as the challenge's do (see Worker::isPlain)
+  bool hasPlainWorkers ()
+  {
+    for ( u32int w = 0; w < numberOfWorkers; w++ )
+    {
+      if ( !workerTable[w]->isPlain() )
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+  
+  // Sets the mean steps between breakdowns and to repair them, for the belt (when the whole line stops) and for each
+  // station (when its workers stop).  A mean time between of 0 means it never breaks down.
+  void setBreakdowns ( u32int beltMtbf, u32int beltMttr, u32int stationMtbf, u32int stationMttr )
+  {
+    beltBetween = beltMtbf;
+    beltRepair = beltMttr;
+    stationBetween = stationMtbf;
+    stationRepair = stationMttr;
+  }
+  
+  bool hasBreakdowns ()
+  {
+    return beltBetween > 0 || stationBetween > 0;
+  }
+  
+  // Whether the belt has only what stepCompressed() knows about
+  bool canCompress ()
+  {
+    return !loop && isUnitSpeed() && sink == NULL && numberOfFeeders == 0 && numberOfFloaters == 0 &&
+           !hasBreakdowns() && !hasLongItems();
+  }
+  
+  bool hasStationBreakdowns ()
+  {
+    return stationBetween > 0;
+  }
+  
+  // Brings the broken stations up to date for "step" (they only change at the steps in their schedules), and says
+  // whether the belt itself is down.
+  bool updateBreakdowns ( u64int step )
+  {
+    if ( !breakdownsStarted )
+    {
+      startBreakdowns();
+    }
+    lastBreakdownStep = step;
+    
+    if ( stationBreakdowns != NULL && step >= nextStationChange )
+    {
+      nextStationChange = ~0ULL;
+      for ( u32int s = 0; s < numberOfStations; s++ )
+      {
+        if ( stationBreakdowns[s]->isDown ( step ) )
+        {
+          setBit ( brokenSlots, stationSlot[s] );
+        }
+        else
+        {
+          clearBit ( brokenSlots, stationSlot[s] );
+        }
+        u64int change = stationBreakdowns[s]->getNextChange ( step );
+        nextStationChange = ( change < nextStationChange ) ? change : nextStationChange;
+      }
+    }
+    return beltBreakdowns != NULL && beltBreakdowns->isDown ( step );
+  }
+  
+  // The first step after "step" with the belt up again
+  u64int getBeltUpAt ( u64int step )
+  {
+    return beltBreakdowns->getNextChange ( step );
+  }
+  
+  // Makes everything the steps need up front (the station index and the breakdown schedules), so a line that has
+  // been set up never allocates while it runs.
+  void prepare ()
+  {
+    if ( !stationsBuilt )
+    {
+      buildStations();
+    }
+    if ( beltBetween > 0 && beltBreakdowns == NULL )
+    {
+      beltBreakdowns = new BreakdownSchedule ( beltBetween, beltRepair );
+    }
+    if ( stationBetween > 0 && stationBreakdowns == NULL )
+    {
+      stationBreakdowns = (BreakdownSchedule **) malloc ( numberOfStations * sizeof(BreakdownSchedule *) );
+      for ( u32int s = 0; s < numberOfStations; s++ )
+      {
+        stationBreakdowns[s] = new BreakdownSchedule ( stationBetween, stationRepair );
+      }
+    }
+  }
+  
+  void startBreakdowns ()
+  {
+    prepare();
+    
+    // Each schedule has its own stream, seeded from the line's
+    u64int seed = ( currentRandomStream != NULL ) ? currentRandomStream->next() : (u64int) random();
+    if ( beltBreakdowns != NULL )
+    {
+      beltBreakdowns->start ( seed, ~0ULL );
+    }
+    for ( u32int s = 0; stationBreakdowns != NULL && s < numberOfStations; s++ )
+    {
+      stationBreakdowns[s]->start ( seed, s );
+    }
+    breakdownsStarted = true;
+  }
+  
+  void printBreakdownCounts ()
+  {
+    u64int stationFailures = 0;
+    
+    for ( u32int s = 0; stationBreakdowns != NULL && s < numberOfStations; s++ )
+    {
+      stationFailures += stationBreakdowns[s]->getFailures ( lastBreakdownStep );
+    }
+    printf("The belt broke down %llu times, the stations %llu times\n",
+           (unsigned long long) ( ( beltBreakdowns != NULL ) ? beltBreakdowns->getFailures ( lastBreakdownStep ) : 0 ),
+           (unsigned long long) stationFailures);
+  }
+  
+  u64int getNumberOfMoves ()
+  {
+    return numberOfMoves;
+  }
+  
+  void addItemFactory ( ItemType *newType, u32int weighting )
+  {
+    ItemType *oldHead = itemsToMake;
+    
+    // Add the new item factory to the head of the list.
+    itemsToMake = newType;
+    newType->nextItemType = oldHead;
+    
+    // Remember its weighting in the object
+    newType->setWeighting ( weighting );
+    
+    // Keep a record of the total weight (so relative probabilities can be calculated ).
+    totalItemWeighting += weighting;
+    
+    // Recalculate the item type probabilities
+    ItemType *it = itemsToMake;
+    
+    while ( it != NULL )
+    {
+      probability p; // Probability for this item type to be generated in any given iteration
+      
+      p =  ((probability) it->getWeighting() ) / ((probability) totalItemWeighting);
+      it->setGenerationProbability (p);
+      
+      it = it->nextItemType;
+    }
+  }
+
+  void addFinishedItem ( ItemType *fit)
+  {
+    ItemType *oldHead = finishedItems;
+    
+    // Add the new finished item type to the head of the list.
+    finishedItems = fit;
+    fit->nextItemType = oldHead;
+  }
+  
+  ItemType *getFinishedItems ()
+  {
+    return finishedItems;
+  }
+  
+  ItemType *getItemFactories ()
+  {
+    return itemsToMake;
+  }
+  
+  u32int getNumberOfWorkers ()
+  {
+    return numberOfWorkers;
+  }
+  
+  // By default a step gives one worker, drawn at random with their work probabilities, a turn at their slot (the
+  // challenge's original model).  This gives every worker a turn each step instead, in weighted random order.
+  void setEveryWorker ( bool e )
+  {
+    everyWorker = e;
+  }
+  
+  bool isEveryWorker ()
+  {
+    return everyWorker;
+  }
+  
+  u32int getNumberOfSlots ()
+  {
+    return numberOfSlots;
+  }
+  
+  // Makes the belt a loop, where unclaimed items come round again.  Finished items can be taken off at an output
+  // station (a slot number), otherwise everything stays on the loop.
+  void setLoop ( bool l, int output = -1 )
+  {
+    loop = l;
+    outputSlot = ( output < (int) numberOfSlots ) ? output : -1;
+  }
+  
+  bool isLoop ()
+  {
+    return loop;
+  }
+  
+  // Sets the belt speed to "slots" slots every "steps" steps: a whole number of slots per step, or a fraction, where
+  // the belt moves on some steps and not others, to a fixed schedule.
+  void setSpeed ( u32int slots, u32int steps = 1 )
+  {
+    speedSlots = slots;
+    speedSteps = ( steps > 0 ) ? steps : 1;
+  }
+  
+  bool isUnitSpeed ()
+  {
+    return speedSlots == speedSteps;
+  }
+  
+  // How many slots the belt moves on a given step.  The moves are spread over each speedSteps steps as evenly as
+  // whole slots allow (so 3/2 goes 1, 2, 1, 2 ...).
+  u32int getSlotsForStep ( u64int step )
+  {
+    return scheduledCount ( step, speedSlots, speedSteps );
+  }
+  
+  u64int getSlotsForSteps ( u64int step, u64int k )
+  {
+    return scheduledTotal ( step, k, speedSlots, speedSteps );
+  }
+  
+  // Sends items off the end of a straight belt to a sink (which the belt then owns)
+  void setSink ( OutputSink *s )
+  {
+    delete sink;
+    sink = s;
+  }
+  
+  OutputSink *getSink ()
+  {
+    return sink;
+  }
+  
+  // Adds a side feeder (which the belt then owns)
+  void addFeeder ( Feeder *f )
+  {
+    feeders = (Feeder **) realloc ( feeders, (numberOfFeeders + 1) * sizeof(Feeder *) );
+    feeders[numberOfFeeders++] = f;
+  }
+  
+  u32int getNumberOfFeeders ()
+  {
+    return numberOfFeeders;
+  }
+  
+  // Each feeder's arrival for this slot move goes onto the belt at its slot, if the slot is empty, otherwise it is
+  // turned away.
+  void injectFeeders ()
+  {
+    for ( u32int f = 0; f < numberOfFeeders; f++ )
+    {
+      ItemType *it = feeders[f]->getNextArrival();
+      u32int slot = feeders[f]->getPosition();
+      
+      if ( isEmpty ( it ) )
+      {
+        continue;
+      }
+      if ( isEmpty ( getSlot ( slot ) ) )
+      {
+        setSlot ( it, slot );
+        LineObserver::onArrival ( it );
+      }
+      else
+      {
+        it->incrementNumberRejected();
+      }
+    }
+  }
+  
+  // Whether the item in the last slot can't leave, because the sink is full
+  bool isBlocked ()
+  {
+    ItemType *last = getSlot ( numberOfSlots - 1 );
+    return sink != NULL && !loop && sink->isFull() && !isEmpty ( last ) && !isContinuation ( last );
+  }
+  
+  bool isStuck ()
+  {
+    return stuck;
+  }
+  
+  void setStuck ( bool s )
+  {
+    stuck = s;
+  }
+  
+  // Whether arrivals can be turned away: on a loop, a belt which slips when blocked, or at a side feeder
+  bool canReject ()
+  {
+    return loop || ( sink != NULL && sink->getBlocking() == SINK_SLIP ) || numberOfFeeders > 0;
+  }
+  
+  bool isAnyWorkerReady ()
+  {
+    if ( !stationsBuilt )
+    {
+      buildStations();
+    }
+    for ( u32int i = 0; i < BITSET_WORDS ( numberOfWorkers ); i++ )
+    {
+      if ( readyWorkers[i] != 0 )
+      {
+        return true;
+      }
+    }
+    return false;
+  }
+  
+  bool hasSlotChanged ()
+  {
+    return slotChanged;
+  }
+  
+  u32int getMaxSlotsPerStep ()
+  {
+    return ( speedSlots + speedSteps - 1 ) / speedSteps;
+  }
+  
+  bool isFinishedItem ( ItemType *it )
+  {
+    for ( ItemType *fit = finishedItems; fit != NULL; fit = fit->nextItemType )
+    {
+      if ( fit == it )
+      {
+        return true;
+      }
+    }
+    return false;
+  }
+  
+  // Workers by index, in list order
+  Worker *getWorker ( u32int index )
+  {
+    return workerTable[index];
+  }
+  
+  // Where worker "index" is now (floaters move about)
+  u32int getWorkerPosition ( u32int index )
+  {
+    return workerPositions[index];
+  }
+  
+  ItemType *getNextItem()
+  {
+    // We select the next item randomly but according to probability weight
+    // this is done by laying out the itemTypes across the probability space between 0.0 and 1.0
+    // The total probabilities should already add up to 1.0 as they are calculated afresh as each
+    // item type is added.
+    probability p = getRandomNumber ();
+    probability cumulative = (probability) 0.0;
+    
+    ItemType *it = itemsToMake;
+    while ( it != NULL )
+    {
+      cumulative += it->getGenerationProbability();
+      if ( p <= cumulative )
+      {
+        return it;
+      }
+      it = it->nextItemType;
+    }
+    printf ("Eeek, probability p (%f) did not hit any items in the probability space.\n",p);
+    
+    return NULL;
+  }
+  
+  // Draws the order the m workers at one station take their turns in, weighted by their work probabilities:
+  // each turn goes to one of those left, with probability in proportion to their weight.  This is the same as
+  // drawing every worker on the belt in turn by weight (the relative order of any group comes out with the same
+  // probabilities), but only the stations with something to do need to draw.
+  // On return, order[k] is the position in "weights" of the k'th worker to act.
+  static void drawTurnOrder ( probability *weights, u32int m, u32int *order )
+  {
+    probability remaining = (probability) 0.0;
+    
+    for ( u32int j = 0; j < m; j++ )
+    {
+      order[j] = j;
+      remaining += weights[j];
+    }
+    
+    // The last one left doesn't need a draw
+    for ( u32int k = 0; k + 1 < m; k++ )
+    {
+      probability p = getRandomNumber() * remaining;
+      probability cumulative = (probability) 0.0;
+      u32int chosen = m - 1; // If float rounding leaves p past the last bucket, it's the last of them
+      
+      for ( u32int j = k; j < m; j++ )
+      {
+        cumulative += weights[order[j]];
+        if ( p <= cumulative )
+        {
+          chosen = j;
+          break;
+        }
+      }
+      
+      remaining -= weights[order[chosen]];
+      u32int swap = order[k];
+      order[k] = order[chosen];
+      order[chosen] = swap;
+    }
+  }
+  
+  static int compareKeys ( const void *a, const void *b )
+  {
+    u64int ka = *(const u64int *) a, kb = *(const u64int *) b;
+    return ( ka < kb ) ? -1 : ( ka > kb );
+  }
+  
+  // Builds the slot to worker index, and works out who is ready to act. Sorting the workers by position costs
+  // nothing per slot, so it suits long belts with only a few stations.
+  void buildStations ()
+  {
+    stationSlot = (u32int *) realloc ( stationSlot, numberOfWorkers * sizeof(u32int) );
+    stationFirst = (u32int *) realloc ( stationFirst, (numberOfWorkers + 1) * sizeof(u32int) );
+    stationWorkers = (u32int *) realloc ( stationWorkers, numberOfWorkers * sizeof(u32int) );
+    stationWeights = (probability *) realloc ( stationWeights, numberOfWorkers * sizeof(probability) );
+    turnPicks = (u32int *) realloc ( turnPicks, numberOfWorkers * sizeof(u32int) );
+    free ( readyWorkers );
+    readyWorkers = (u64int *) calloc ( BITSET_WORDS ( numberOfWorkers ), sizeof(u64int) );
+    memset ( staffedSlots, 0, BITSET_WORDS ( numberOfSlots ) * sizeof(u64int) );
+    
+    // Sort by position, then index (so list order within a slot), as one key
+    u64int *keys = (u64int *) malloc ( numberOfWorkers * sizeof(u64int) );
+    for ( u32int w = 0; w < numberOfWorkers; w++ )
+    {
+      keys[w] = ( ((u64int) workerPositions[w]) << 32 ) | w;
+    }
+    qsort ( keys, numberOfWorkers, sizeof(u64int), compareKeys );
+    for ( u32int w = 0; w < numberOfWorkers; w++ )
+    {
+      stationWorkers[w] = (u32int) keys[w];
+    }
+    free ( keys );
+    
+    numberOfStations = 0;
+    for ( u32int i = 0; i < numberOfWorkers; i++ )
+    {
+      u32int w = stationWorkers[i];
+      
+      if ( numberOfStations == 0 || stationSlot[numberOfStations - 1] != workerPositions[w] )
+      {
+        stationSlot[numberOfStations] = workerPositions[w];
+        stationFirst[numberOfStations++] = i;
+        setBit ( staffedSlots, workerPositions[w] );
+      }
+      stationWeights[i] = workerTable[w]->getWorkProbability();
+      
+      if ( finishedItems != NULL && workerTable[w]->isReadyToAct ( finishedItems ) )
+      {
+        setBit ( readyWorkers, w );
+      }
+    }
+    stationFirst[numberOfStations] = numberOfWorkers;
+    stationEntries = numberOfWorkers;
+    
+    free ( stationCounters );
+    stationCounters = (StationCounters *) calloc ( numberOfStations, sizeof(StationCounters) );
+    
+    u32int rank = 0;
+    for ( u32int i = 0; i < BITSET_WORDS ( numberOfSlots ); i++ )
+    {
+      staffedRank[i] = rank;
+      rank += __builtin_popcountll ( staffedSlots[i] );
+    }
+    
+    if ( compressed )
+    {
+      delete [] stretches;
+      free ( stretchDelay );
+      stretches = new DelayQueue[numberOfStations + 1];
+      stretchDelay = (u32int *) malloc ( (numberOfStations + 1) * sizeof(u32int) );
+      for ( u32int s = 0; s <= numberOfStations; s++ )
+      {
+        u32int from = ( s == 0 ) ? 0 : stationSlot[s - 1], to = ( s == numberOfStations ) ? numberOfSlots : stationSlot[s];
+        stretchDelay[s] = to - from;
+        // At most one item goes on a stretch each step, and each is off it again stretchDelay steps later
+        stretches[s].reserve ( stretchDelay[s] + 1 );
+      }
+    }
+    
+    // Every worker is at a station to start with, including the floaters
+    for ( u32int f = 0; f < numberOfFloaters; f++ )
+    {
+      for ( u32int w = 0; w < numberOfWorkers; w++ )
+      {
+        if ( workerTable[w] == floaters[f].worker )
+        {
+          floaters[f].index = w;
+          floaters[f].station = getStationAt ( workerPositions[w] );
+          floaters[f].moving = false;
+        }
+      }
+    }
+    stationsBuilt = true;
+  }
+  
+  // The station at a staffed slot
+  u32int getStationAt ( u32int slot )
+  {
+    u64int below = staffedSlots[slot / BITS_PER_WORD] & ( ( 1ULL << (slot % BITS_PER_WORD) ) - 1 );
+    return staffedRank[slot / BITS_PER_WORD] + __builtin_popcountll ( below );
+  }
+  
+  u32int getNumberOfStations ()
+  {
+    if ( !stationsBuilt )
+    {
+      buildStations();
+    }
+    return numberOfStations;
+  }
+  
+  // Station s has workers getStationWorker ( getStationFirst ( s ) ) .. ( getStationFirst ( s + 1 ) - 1 )
+  u32int getStationSlot ( u32int s )
+  {
+    return stationSlot[s];
+  }
+  
+  u32int getStationFirst ( u32int s )
+  {
+    return stationFirst[s];
+  }
+  
+  u32int getStationWorker ( u32int n )
+  {
+    return stationWorkers[n];
+  }
+  
+  // Gives every worker a turn at their slot, in weighted random order, skipping the stations with nothing to do:
+  // those with an empty slot and no worker ready to act, where doWork() would change nothing.  Unless every worker
+  // gets a turn (see setEveryWorker), only the one drawn by workTurn() does.
+  void workStations ()
+  {
+    if ( !stationsBuilt )
+    {
+      buildStations();
+    }
+    
+    slotChanged = false;
+    
+    if ( !everyWorker )
+    {
+      workTurn();
+      return;
+    }
+    
+    u32int words = BITSET_WORDS ( numberOfSlots );
+    for ( u32int i = 0; i < words; i++ )
+    {
+      activeSlots[i] = occupiedSlots[i] & staffedSlots[i];
+    }
+    for ( u32int i = 0; i < BITSET_WORDS ( numberOfWorkers ); i++ )
+    {
+      for ( u64int bits = readyWorkers[i]; bits != 0; bits &= bits - 1 )
+      {
+        setBit ( activeSlots, workerPositions[i * BITS_PER_WORD + __builtin_ctzll ( bits )] );
+      }
+    }
+    
+    // Broken down stations do nothing at all
+    if ( stationBreakdowns != NULL )
+    {
+      for ( u32int i = 0; i < words; i++ )
+      {
+        activeSlots[i] &= ~brokenSlots[i];
+      }
+    }
+    
+    // Stations only touch their own slot, so it doesn't matter that we take them in slot order
+    for ( u32int i = 0; i < words; i++ )
+    {
+      for ( u64int bits = activeSlots[i]; bits != 0; bits &= bits - 1 )
+      {
+        workStation ( getStationAt ( i * BITS_PER_WORD + __builtin_ctzll ( bits ) ) );
+      }
+    }
+  }
+  
+  // The original model's step: one worker, drawn at random with their work probabilities (in list order, as the
+  // workers were), gets a turn.  Returns their entry in the station index, and their station in *station, or -1 if
+  // they miss their turn: a floater on the move, or at a station which is broken down.
+  int drawTurn ( u32int *station )
+  {
+    probability p = getRandomNumber ();
+    probability cumulative = (probability) 0.0;
+    u32int w = 0;
+    
+    if ( numberOfWorkers == 0 )
+    {
+      return -1;
+    }
+    
+    // The last worker takes whatever float rounding leaves past the end of the others
+    while ( w + 1 < numberOfWorkers )
+    {
+      cumulative += workerTable[w]->getWorkProbability();
+      if ( p <= cumulative )
+      {
+        break;
+      }
+      w++;
+    }
+    
+    u32int slot = workerPositions[w];
+    if ( stationBreakdowns != NULL && testBit ( brokenSlots, slot ) )
+    {
+      return -1;
+    }
+    *station = getStationAt ( slot );
+    for ( u32int i = stationFirst[*station]; i < stationFirst[*station + 1]; i++ )
+    {
+      if ( stationWorkers[i] == w )
+      {
+        return i;
+      }
+    }
+    return -1;
+  }
+  
+  // Gives the drawn worker their turn.  Their slot may be empty with them not ready to act, but it is only one
+  // worker, so there is nothing to gain from skipping them.
+  void workTurn ()
+  {
+    u32int station = 0;
+    int entry = drawTurn ( &station );
+    
+    if ( entry >= 0 )
+    {
+      workStation ( station, entry );
+    }
+  }
+  
+  // The workers at a station have their turns at its slot (or, with "only" set, just the one at that entry in the
+  // station index)
+  void workStation ( u32int station, int only = -1 )
+  {
+    u32int slot = stationSlot[station];
+    ItemType *before = getSlot ( slot );
+    ItemType *after = hasLongItems() ? workLongItem ( station, before, only ) : workItem ( station, before, only );
+    
+    slotChanged |= ( after != before );
+    setSlot ( after, slot );
+  }
+  
+  // Gives the workers at a station their turns at one item (or, with "only" set, just the one at that entry in the
+  // station index), and returns what is left in the slot afterwards
+  ItemType *workItem ( u32int station, ItemType *item, int only = -1 )
+  {
+    u32int first = stationFirst[station], m = stationFirst[station + 1] - first;
+    ItemType *offered = item;
+    
+    if ( only >= 0 )
+    {
+      turnPicks[0] = only - first;
+      m = 1;
+    }
+    else if ( m > 1 )
+    {
+      drawTurnOrder ( &stationWeights[first], m, turnPicks );
+    }
+    else
+    {
+      turnPicks[0] = 0;
+    }
+    
+    for ( u32int k = 0; k < m; k++ )
+    {
+      u32int w = stationWorkers[first + turnPicks[k]];
+      Worker *wk = workerTable[w];
+      
+      // Offer the item to the worker, worker returns the new contents of the slot ( which may be the same thing we gave them )
+      item = wk->doWork ( item, finishedItems );
+      
+      if ( wk->isReadyToAct ( finishedItems ) )
+      {
+        setBit ( readyWorkers, w );
+      }
+      else
+      {
+        clearBit ( readyWorkers, w );
+      }
+    }
+    
+    if ( !isEmpty ( offered ) )
+    {
+      stationCounters[station].offered++;
+      stationCounters[station].missed += ( item == offered );
+    }
+    return item;
+  }
+  
+  // Takes worker w out of station s's entries in the station index, closing up the entries after it
+  void leaveStation ( u32int s, u32int w )
+  {
+    u32int i = stationFirst[s];
+    
+    while ( stationWorkers[i] != w )
+    {
+      i++;
+    }
+    memmove ( &stationWorkers[i], &stationWorkers[i + 1], (stationEntries - i - 1) * sizeof(u32int) );
+    memmove ( &stationWeights[i], &stationWeights[i + 1], (stationEntries - i - 1) * sizeof(probability) );
+    stationEntries--;
+    for ( u32int t = s + 1; t <= numberOfStations; t++ )
+    {
+      stationFirst[t]--;
+    }
+  }
+  
+  // Adds worker w to the end of station s's entries, opening up a gap for them
+  void joinStation ( u32int s, u32int w )
+  {
+    u32int i = stationFirst[s + 1];
+    
+    memmove ( &stationWorkers[i + 1], &stationWorkers[i], (stationEntries - i) * sizeof(u32int) );
+    memmove ( &stationWeights[i + 1], &stationWeights[i], (stationEntries - i) * sizeof(probability) );
+    stationWorkers[i] = w;
+    stationWeights[i] = workerTable[w]->getWorkProbability();
+    stationEntries++;
+    for ( u32int t = s + 1; t <= numberOfStations; t++ )
+    {
+      stationFirst[t]++;
+    }
+    workerPositions[w] = stationSlot[s];
+    workerTable[w]->setPosition ( stationSlot[s] );
+  }
+  
+  // Called once a step, before the stations work: floaters who have finished moving join their new station, and
+  // every reassignInterval steps, the floaters who aren't busy (not ready to act, see Worker::isReadyToAct) are
+  // given the chance to move, and the station counters start again.  A move only shifts the station index entries
+  // between the two stations, so it costs no more than the workers in between.
+  void updateFloaters ()
+  {
+    if ( !stationsBuilt )
+    {
+      buildStations();
+    }
+    floaterClock++;
+    
+    for ( u32int f = 0; f < numberOfFloaters; f++ )
+    {
+      if ( floaters[f].moving && floaters[f].arrives == floaterClock )
+      {
+        joinStation ( floaters[f].station, floaters[f].index );
+        floaters[f].moving = false;
+      }
+    }
+    
+    if ( floaterClock % reassignInterval != 0 )
+    {
+      return;
+    }
+    
+    for ( u32int f = 0; f < numberOfFloaters; f++ )
+    {
+      if ( floaters[f].moving || testBit ( readyWorkers, floaters[f].index ) )
+      {
+        continue;
+      }
+      
+      int to = reassignPolicy ( stationCounters, numberOfStations, floaters[f].station );
+      if ( to < 0 || (u32int) to == floaters[f].station )
+      {
+        continue;
+      }
+      
+      leaveStation ( floaters[f].station, floaters[f].index );
+      floaters[f].station = to;
+      numberOfMoves++;
+      if ( moveCost == 0 )
+      {
+        joinStation ( to, floaters[f].index );
+      }
+      else
+      {
+        floaters[f].moving = true;
+        floaters[f].arrives = floaterClock + moveCost;
+      }
+    }
+    memset ( stationCounters, 0, numberOfStations * sizeof(StationCounters) );
+  }
+  
+  // Whether the line makes items longer than a slot (only finished items can be)
+  bool hasLongItems ()
+  {
+    return finishedItems != NULL && finishedItems->getSize() > 1;
+  }
+  
+  static bool isContinuation ( ItemType *it )
+  {
+    return it == &continuationMarker;
+  }
+  
+  // The slot "back" places behind "slot", following the belt round on a loop (or -1 if that is off the belt)
+  int getSlotBehind ( u32int slot, u32int back )
+  {
+    if ( slot >= back )
+    {
+      return slot - back;
+    }
+    return loop ? (int) ( slot + numberOfSlots - back ) : -1;
+  }
+  
+  // Empties the continuations of a long item whose head is (or was) at "slot"
+  void clearContinuations ( u32int slot, u32int size )
+  {
+    for ( u32int i = 1; i < size; i++ )
+    {
+      int behind = getSlotBehind ( slot, i );
+      if ( behind >= 0 && isContinuation ( getSlot ( behind ) ) )
+      {
+        setSlot ( NULL, behind );
+      }
+    }
+  }
+  
+  // workItem() for a line making items longer than a slot. A worker about to finish one only does so when it fits,
+  // in the empty slots from theirs back (otherwise they wait, and try again on their next turn).  Nobody picks up a
+  // continuation, though the workers still get their turn (to carry on assembling), and picking up the head of a
+  // long item takes all of it off the belt.
+  ItemType *workLongItem ( u32int station, ItemType *item, int only = -1 )
+  {
+    u32int slot = stationSlot[station], first = stationFirst[station], m = stationFirst[station + 1] - first;
+    ItemType *offered = item;
+    
+    if ( only >= 0 )
+    {
+      turnPicks[0] = only - first;
+      m = 1;
+    }
+    else if ( m > 1 )
+    {
+      drawTurnOrder ( &stationWeights[first], m, turnPicks );
+    }
+    else
+    {
+      turnPicks[0] = 0;
+    }
+    
+    for ( u32int k = 0; k < m; k++ )
+    {
+      u32int w = stationWorkers[first + turnPicks[k]];
+      Worker *wk = workerTable[w];
+      ItemType *product = wk->getProduct ( finishedItems );
+      u32int size = product->getSize();
+      
+      // The slots behind us are up to date in occupiedSlots, ours is "item"
+      if ( wk->isAboutToFinish() &&
+           ( slot + 1 < size || !isEmpty ( item ) || anyBitsInRange ( occupiedSlots, slot + 1 - size, slot ) ) )
+      {
+        LINE_PROBE2 ( placement_blocked, wk, slot );
+        continue;
+      }
+      
+      ItemType *head = item;
+      ItemType *out = wk->doWork ( isContinuation ( item ) ? NULL : item, finishedItems );
+      
+      if ( isContinuation ( item ) )
+      {
+        out = ( out == NULL ) ? item : out;
+      }
+      else if ( out != head && !isEmpty ( head ) && head->getSize() > 1 )
+      {
+        clearContinuations ( slot, head->getSize() );
+      }
+      if ( out == product && out != head )
+      {
+        for ( u32int i = 1; i < size; i++ )
+        {
+          setSlot ( &continuationMarker, slot - i );
+        }
+      }
+      item = out;
+      
+      if ( wk->isReadyToAct ( finishedItems ) )
+      {
+        setBit ( readyWorkers, w );
+      }
+      else
+      {
+        clearBit ( readyWorkers, w );
+      }
+    }
+    
+    if ( !isEmpty ( offered ) )
+    {
+      stationCounters[station].offered++;
+      stationCounters[station].missed += ( item == offered );
+    }
+    return item;
+  }
+  
+  bool isStationReady ( u32int station )
+  {
+    for ( u32int i = stationFirst[station]; i < stationFirst[station + 1]; i++ )
+    {
+      if ( testBit ( readyWorkers, stationWorkers[i] ) )
+      {
+        return true;
+      }
+    }
+    return false;
+  }
+  
+  bool isCompressed ()
+  {
+    return compressed;
+  }
+  
+  // Items on the belt, for a compressed belt
+  u64int getItemsInFlight ()
+  {
+    u64int n = 0;
+    for ( u32int s = 0; stretches != NULL && s <= numberOfStations; s++ )
+    {
+      n += stretches[s].getCount();
+    }
+    return n;
+  }
+  
+  // One step of a compressed belt: the same as advanceBelt ( 1 ), placeNewItem ( next ) and workStations() on the
+  // slots, with the same draws, but only touching the stations and the items reaching them.  An item put into the
+  // entry slot (or left in a station's slot) on step "step" reaches the end of its stretch stretchDelay steps later,
+  // and the ones nobody touches go straight through to be counted off the end.  Only straight belts moving a slot a
+  // step, without the extras (sinks, feeders and so on), can be compressed (see canCompress).
+  void stepCompressed ( ItemType *next, u64int step )
+  {
+    if ( !stationsBuilt )
+    {
+      buildStations();
+    }
+    
+    for ( ItemType *it = stretches[numberOfStations].popBy ( step ); it != NULL;
+          it = stretches[numberOfStations].popBy ( step ) )
+    {
+      it->incrementNumberCollected();
+      LineObserver::onExit ( it );
+    }
+    
+    stretches[0].push ( next, step + stretchDelay[0] );
+    LineObserver::onArrival ( next );
+    
+    u32int turnStation = 0;
+    int turn = everyWorker ? -1 : drawTurn ( &turnStation );
+    
+    for ( u32int s = 0; s < numberOfStations; s++ )
+    {
+      ItemType *item = stretches[s].popBy ( step );
+      
+      if ( everyWorker ? ( !isEmpty ( item ) || isStationReady ( s ) ) : ( turn >= 0 && s == turnStation ) )
+      {
+        item = workItem ( s, item, turn );
+      }
+      if ( item != NULL )
+      {
+        stretches[s + 1].push ( item, step + stretchDelay[s + 1] );
+      }
+    }
+  }
+  
+  // Moves a straight belt along n slots (at most its length) and gives the workers a turn at every slot passing
+  // their station, in the order they pass, just as n steps of one slot would (arrivals[k] being the item that
+  // arrives with the k'th slot).  Rather than n passes over the belt, each station takes the n slots passing it
+  // in one go: a slot only moves on to higher stations, so taking the stations in slot order still has each slot
+  // reach a station after the stations before it have worked on it.  A station with nothing passing and no
+  // worker ready is skipped whole, a word of the occupied slots at a time.
+  void advanceAndWork ( u32int n, ItemType **arrivals )
+  {
+    if ( !stationsBuilt )
+    {
+      buildStations();
+    }
+    
+    for ( u32int k = 0; k < n; k++ )
+    {
+      LineObserver::onArrival ( arrivals[k] );
+    }
+    
+    // Before the move, slot j passes the stations at j + 1 .. j + n.  Arrival k comes on with the (k + 1)'th slot
+    // so, for the stations, it is slot -(k + 1), which is kept in arrivals[] until the belt has moved.
+    for ( u32int s = 0; s < numberOfStations; s++ )
+    {
+      int p = stationSlot[s];
+      int lowest = ( p > (int) n ) ? p - n : 0;
+      bool arriving = false;
+      
+      if ( testBit ( brokenSlots, p ) )
+      {
+        continue;
+      }
+      
+      for ( int k = p; k < (int) n && !arriving; k++ )
+      {
+        arriving = !isEmpty ( arrivals[k - p] );
+      }
+      bool ready = isStationReady ( s );
+      if ( !arriving && !ready && !anyBitsInRange ( occupiedSlots, lowest, p ) )
+      {
+        continue;
+      }
+      
+      // Nearest first, as that is the first to reach the station
+      for ( int j = p - 1; j >= p - (int) n; j-- )
+      {
+        ItemType **cell = ( j >= 0 ) ? &beltSlots[physicalSlot ( j )] : &arrivals[-j - 1];
+        
+        if ( !ready && isEmpty ( *cell ) )
+        {
+          continue;
+        }
+        *cell = workItem ( s, *cell );
+        ready = isStationReady ( s );
+        if ( j >= 0 )
+        {
+          setSlot ( *cell, j );
+        }
+      }
+    }
+    
+    advanceBelt ( n );
+    for ( u32int k = 0; k < n; k++ )
+    {
+      setSlot ( arrivals[k], n - 1 - k );
+    }
+  }
+  
+  // Pulls the state the next step will touch into the cache, without waiting for it: the entry and exit slots,
+  // and each worker along with the slot they work on. Stepping several lines in turn and prefetching the next
+  // one before stepping the current one lets their cache misses overlap, rather than stalling one at a time.
+  void prefetch ()
+  {
+    if ( compressed )
+    {
+      return;
+    }
+    __builtin_prefetch ( &beltSlots[physicalSlot ( 0 )], 1 /* for writing */ );
+    __builtin_prefetch ( &beltSlots[physicalSlot ( numberOfSlots - 1 )], 1 );
+    
+    for ( u32int w = 0; w < numberOfWorkers; w++ )
+    {
+      __builtin_prefetch ( workerTable[w], 1 );
+      __builtin_prefetch ( &beltSlots[physicalSlot ( workerPositions[w] )], 1 );
+    }
+  }
+  
+  static bool isEmpty ( ItemType *it )
+  {
+    return it == NULL || it->getId() == (u32int) NULL_ITEM_ID; // There can be two sorts of empty slot
+  }
+  
+  // Where slot "slot" currently is in the ring
+  u32int physicalSlot ( u32int slot )
+  {
+    u32int p = ringStart + slot;
+    return ( p >= numberOfSlots ) ? p - numberOfSlots : p;
+  }
+  
+  void setSlot ( ItemType *itemType, u32int slot )
+  {
+    beltSlots[physicalSlot ( slot )] = itemType;
+    
+    if ( isEmpty ( itemType ) )
+    {
+      clearBit ( occupiedSlots, slot );
+    }
+    else
+    {
+      setBit ( occupiedSlots, slot );
+    }
+  }
+  
+  ItemType *getSlot ( u32int slot )
+  {
+    return beltSlots[physicalSlot ( slot )];
+  }
+  
+  // Puts a newly arrived item in the entry slot.  On a loop the slot may still hold something coming round (or on a
+  // blocked belt, something which couldn't move on), in which case the new item can't get on, and is counted as
+  // rejected.
+  void placeNewItem ( ItemType *next )
+  {
+    if ( !isEmpty ( getSlot ( 0 ) ) )
+    {
+      if ( !isEmpty ( next ) )
+      {
+        next->incrementNumberRejected();
+        LINE_PROBE1 ( arrival_rejected, next->getName() );
+      }
+      return;
+    }
+    setSlot ( next, 0 );
+    LineObserver::onArrival ( next );
+  }
+
+  void advanceBelt ( int n )
+  {
+    // Move the "belt" along by n slots, new slots are zero'd, items coming off the belt are counted by type
+    // The slots are a ring, so rather than copying every slot along, ringStart moves back n places, and whatever
+    // was in the last n slots comes round to the start.  On a straight belt, those are first counted off the end
+    // and emptied. On a loop they carry on round, other than finished items passing the output station.
+    u32int lastSlot = (numberOfSlots - 1); /* Zero based array */
+    u32int passing = ( (u32int) n < numberOfSlots ) ? n : numberOfSlots;
+    
+    for ( u32int i = 0; i < passing; i++ )
+    {
+      if ( !loop )
+      {
+        // Take the n last slots off the belt and count any items
+        ItemType *it = getSlot ( lastSlot - i );
+        
+        if ( it != NULL && !isContinuation ( it ) ) // The rest of a long item, which went with its head
+        {
+          it->incrementNumberCollected();
+          LINE_PROBE1 ( exit, it->getName() );
+          LineObserver::onExit ( it );
+          if ( sink != NULL && !isEmpty ( it ) )
+          {
+            sink->accept();
+          }
+        }
+        setSlot ( NULL, lastSlot - i );
+      }
+      else if ( outputSlot >= 0 )
+      {
+        // Everything in the n slots up to the output station passes it
+        u32int slot = ( outputSlot >= (int) i ) ? outputSlot - i : outputSlot + numberOfSlots - i;
+        ItemType *it = getSlot ( slot );
+        
+        if ( it != NULL && isFinishedItem ( it ) )
+        {
+          it->incrementNumberCollected();
+          LINE_PROBE1 ( exit, it->getName() );
+          LineObserver::onExit ( it );
+          setSlot ( NULL, slot );
+          clearContinuations ( slot, it->getSize() );
+        }
+      }
+    }
+    
+    ringStart = ( ringStart + numberOfSlots - (n % numberOfSlots) ) % numberOfSlots;
+    
+    // The occupied slots move along with the belt
+    if ( loop )
+    {
+      rotateBitsUp ( occupiedSlots, numberOfSlots, n );
+    }
+    else
+    {
+      shiftBitsUp ( occupiedSlots, numberOfSlots, passing );
+    }
+  }
+  
+  // With the last slot blocked, the items behind close up on it: the ones up to the nearest gap move on a slot, and
+  // the entry slot comes free.  Returns false if there is no gap, and so nothing can move.
+  bool slipBelt ()
+  {
+    int gap = numberOfSlots - 1;
+    
+    while ( gap >= 0 && !isEmpty ( getSlot ( gap ) ) )
+    {
+      gap--;
+    }
+    if ( gap < 0 )
+    {
+      return false;
+    }
+    for ( int i = gap; i > 0; i-- )
+    {
+      setSlot ( getSlot ( i - 1 ), i );
+    }
+    setSlot ( NULL, 0 );
+    return true;
+  }
+  
+  void printSinkCounts ()
+  {
+    printf("The output sink took %llu items, the belt was held up %llu times\n",
+           (unsigned long long) sink->getNumberServed(), (unsigned long long) sink->getBlockedMoves());
+  }
+  
+  // What is in every slot, and what every worker is holding and doing, for a look at the line at a point of interest
+  void printState ()
+  {
+    if ( compressed )
+    {
+      printf("Belt: compressed, %llu items on it\n", (unsigned long long) getItemsInFlight());
+    }
+    else
+    {
+      printf("Belt:");
+      for ( u32int i = 0; i < numberOfSlots; i++ )
+      {
+        ItemType *it = getSlot ( i );
+        printf(" %c", isEmpty ( it ) ? '.' : it->getName());
+      }
+      printf("\n");
+    }
+    
+    for ( u32int w = 0; w < numberOfWorkers; w++ )
+    {
+      Worker *wk = workerTable[w];
+      ItemType *lh = wk->getLeftHand(), *rh = wk->getRightHand();
+      
+      printf("Worker %u at slot %u: holding %c %c", w, workerPositions[w], ( lh == NULL ) ? '.' : lh->getName(),
+             ( rh == NULL ) ? '.' : rh->getName());
+      if ( wk->getAssemblyLeft() > 0 )
+      {
+        printf(", assembling (%u steps left)", wk->getAssemblyLeft());
+      }
+      printf("\n");
+    }
+  }
+  
+  void printItemFactoryCounts ()
+  {
+    ItemType *it = itemsToMake;
+    
+    while ( it != NULL )
+    {
+      printf("Item \"%c\", was collected off the belt %llu times\n", it->getName(),
+             (unsigned long long) it->getNumberCollected());
+      
+      it = it->nextItemType;
+    }
+  }
+
+  void printFinishedItemCounts ()
+  {
+    ItemType *it = finishedItems;
+    
+    while ( it != NULL )
+    {
+      printf("Item \"%c\", was collected off the belt %llu times\n", it->getName(),
+             (unsigned long long) it->getNumberCollected());
+      
+      it = it->nextItemType;
+    }
+  }
+  
+  // What goes into each finished item, and how many workers make it
+  void printRecipes ()
+  {
+    for ( ItemType *fit = finishedItems; fit != NULL; fit = fit->nextItemType )
+    {
+      u32int makers = 0;
+      for ( u32int w = 0; w < numberOfWorkers; w++ )
+      {
+        makers += ( workerTable[w]->getProduct ( finishedItems ) == fit );
+      }
+      printf("Item \"%c\" is made from", fit->getName());
+      for ( ItemType **c = fit->getComponentsRequired(); c != NULL && *c != NULL; c++ )
+      {
+        printf(" %c", (*c)->getName());
+      }
+      printf(", by %u workers\n", makers);
+    }
+  }
+  
+  void printRejectedCounts ()
+  {
+    for ( ItemType *it = itemsToMake; it != NULL; it = it->nextItemType )
+    {
+      if ( !isEmpty ( it ) )
+      {
+        printf("Item \"%c\", couldn't get onto the belt %llu times\n", it->getName(),
+               (unsigned long long) it->getNumberRejected());
+      }
+    }
+  }
+  
+  ~Belt()
+  {
+    // We get each worker in the list to recurse and delete its neighbour, then we delete the final one.
+    if ( workers != NULL )
+    {
+      workers->deleteNextWorker();
+      delete workers;
+    }
+    
+    // We get each item in the list to recurse and delete its neighbour, then we delete the final one.
+    if ( itemsToMake != NULL )
+    {
+      itemsToMake->deleteNextItem();
+      delete itemsToMake;
+    }
+    
+    // Likewise for the finished item types
+    if ( finishedItems != NULL )
+    {
+      finishedItems->deleteNextItem();
+      delete finishedItems;
+    }
+    
+    free ( workerTable );
+    free ( workerPositions );
+    free ( occupiedSlots );
+    free ( staffedSlots );
+    free ( activeSlots );
+    free ( readyWorkers );
+    free ( staffedRank );
+    free ( stationSlot );
+    free ( stationFirst );
+    free ( stationWorkers );
+    free ( stationWeights );
+    free ( turnPicks );
+    delete sink;
+    for ( u32int f = 0; f < numberOfFeeders; f++ )
+    {
+      delete feeders[f];
+    }
+    free ( feeders );
+    free ( floaters );
+    free ( stationCounters );
+    delete beltBreakdowns;
+    for ( u32int s = 0; stationBreakdowns != NULL && s < numberOfStations; s++ )
+    {
+      delete stationBreakdowns[s];
+    }
+    free ( stationBreakdowns );
+    free ( brokenSlots );
+    delete [] stretches;
+    free ( stretchDelay );
+    if ( beltSlots != NULL )
+    {
+      freeLarge (beltSlots, numberOfSlots * sizeof(ItemType *), beltSlotsMapped); // To match allocateLarge
+    }
+  }
+
+};
+
+// Item counts a run can stop at, whichever is reached first: "make 500 P", or "until 100 A have gone by untouched"
+#define MAX_RUN_TARGETS 4
+
+struct RunTargets
+{
+  u32int number;
+  ascii name[MAX_RUN_TARGETS];
+  u64int count[MAX_RUN_TARGETS];
+};
+
+class ProductionLine
+{
+private:
+
+  Belt *belt;
+  u64int stepNumber; // Steps taken so far, for the belt's speed and sink's service schedules
+  ItemType **arrivals; // Scratch for the items arriving in a step, when the belt moves more than one slot
+public:
+  
+  ProductionLine()
+  {
+    belt = NULL;
+    stepNumber = 0;
+    arrivals = NULL;
+  }
+  
+  void addBelt ( Belt *b)
+  {
+    belt = b;
+    
+    // Sized for the fastest step, so step() never has to grow it
+    free ( arrivals );
+    arrivals = (ItemType **) malloc ( belt->getMaxSlotsPerStep() * sizeof(ItemType *) );
+    belt->prepare();
+  }
+  
+  ~ProductionLine()
+  {
+    if ( belt != NULL )
+    {
+      delete belt;
+    }
+    free ( arrivals );
+  }
+  
+  // Advances the line by one step: the belt moves along as many slots as its speed gives for this step, with a new
+  // item arriving on each slot, and one worker drawn at random gets a turn after each move (or, if the belt says
+  // so, every worker gets a turn at each slot passing them, in weighted random order).
+  // Returns false if the line can't carry on.
+  bool step ()
+  {
+    setAllocationPhase ( ALLOC_RUN );
+    if ( belt->isCompressed() )
+    {
+      ItemType *next = belt->getNextItem();
+      if ( next == NULL )
+      {
+        printf("error: getNextItem failed to produce anything\n");
+        return false;
+      }
+      belt->stepCompressed ( next, stepNumber++ );
+      return true;
+    }
+    
+    OutputSink *sink = belt->getSink();
+    if ( sink != NULL )
+    {
+      sink->serve ( stepNumber );
+    }
+    
+    // While the belt is broken down, nothing moves, arrives or works (see skipDownSteps)
+    if ( belt->hasBreakdowns() && belt->updateBreakdowns ( stepNumber ) )
+    {
+      stepNumber++;
+      return true;
+    }
+    
+    if ( belt->getNumberOfFloaters() > 0 )
+    {
+      belt->updateFloaters();
+    }
+    
+    u32int n = belt->getSlotsForStep ( stepNumber++ );
+    
+    // One slot at a time on a loop (where a slot can pass the same station twice in a step), into a sink (which
+    // can fill up part way through a step), with side feeders (which put items down between moves), with long items
+    // (which need room behind a station), with one worker's turn a move rather than every worker's, and at normal
+    // speed
+    if ( n == 1 || belt->isLoop() || sink != NULL || belt->getNumberOfFeeders() > 0 || belt->hasLongItems() ||
+         !belt->isEveryWorker() )
+    {
+      for ( u32int i = 0; i < n; i++ )
+      {
+        if ( !stepSlot() )
+        {
+          return false;
+        }
+      }
+      return true;
+    }
+    
+    for ( u32int k = 0; k < n; k++ )
+    {
+      arrivals[k] = belt->getNextItem();
+      if ( arrivals[k] == NULL )
+      {
+        printf("error: getNextItem failed to produce anything\n");
+        return false;
+      }
+    }
+    
+    // A belt faster than its length carries some arrivals straight off the end: do a belt's length at a time
+    u32int length = belt->getNumberOfSlots();
+    for ( u32int k = 0; k < n; k += length )
+    {
+      belt->advanceAndWork ( ( n - k < length ) ? n - k : length, &arrivals[k] );
+    }
+    return true;
+  }
+  
+  // Moves the belt on one slot: a new item arrives, the belt moves along, and the workers get their turns
+  bool stepSlot ()
+  {
+    if ( belt->isBlocked() )
+    {
+      return blockedSlot();
+    }
+    belt->setStuck ( false );
+    
+    // Get the next item to place on the belt
+    ItemType *next = belt->getNextItem();
+    if (next == NULL )
+    {
+      printf("error: getNextItem failed to produce anything\n");
+      return false;
+    }
+    DEBUG("Next item is \"%c\".\n", next->getName()); 
+ 
+    // Advance the belt (and count things coming off the end)
+    belt->advanceBelt( 1 /* one step */);
+    
+    // Insert the new item into the entry slot
+    belt->placeNewItem( next );
+    
+    // And any from the side feeders
+    belt->injectFeeders();
+    
+    // Now prod each worker into doing work 
+    belt->workStations();
+    
+    return true;
+  }
+  
+  // A slot move with the output end blocked: the belt stops (or slips), but the workers carry on with whatever is
+  // in front of them, finishing off their assemblies.  Once a blocked move changes nothing, with no worker busy, the
+  // line is stuck until the sink has room, and the moves after it don't give the workers turns (they have already
+  // passed on what is in front of them), so stuck stretches can be skipped over whole (see skipIdleSteps).
+  bool blockedSlot ()
+  {
+    OutputSink *sink = belt->getSink();
+    bool slip = ( sink->getBlocking() == SINK_SLIP );
+    
+    LINE_PROBE1 ( exit_blocked, stepNumber );
+    sink->countBlocked ( 1 );
+    if ( belt->isStuck() )
+    {
+      return !slip || rejectArrivals ( 1 );
+    }
+    
+    bool wasReady = belt->isAnyWorkerReady();
+    bool moved = false;
+    if ( slip )
+    {
+      ItemType *next = belt->getNextItem();
+      if ( next == NULL )
+      {
+        printf("error: getNextItem failed to produce anything\n");
+        return false;
+      }
+      moved = belt->slipBelt();
+      belt->placeNewItem ( next );
+    }
+    belt->workStations();
+    
+    // With one worker's turn a move, the others may still have something to do
+    belt->setStuck ( belt->isEveryWorker() && !wasReady && !moved && !belt->hasSlotChanged() );
+    return true;
+  }
+  
+  // Arrivals at a stuck belt which slips, which all find the entry slot full
+  bool rejectArrivals ( u64int n )
+  {
+    for ( u64int k = 0; k < n; k++ )
+    {
+      ItemType *next = belt->getNextItem();
+      if ( next == NULL )
+      {
+        printf("error: getNextItem failed to produce anything\n");
+        return false;
+      }
+      belt->placeNewItem ( next );
+    }
+    return true;
+  }
+  
+  // How many of the next "limit" steps the line would spend stuck, with nothing happening but the time passing
+  // (and, on a slipping belt, the arrivals being turned away).
+  u64int getIdleSteps ( u64int limit )
+  {
+    if ( !belt->isStuck() || !belt->isBlocked() || belt->getNumberOfFloaters() > 0 || belt->hasStationBreakdowns() )
+    {
+      return 0; // Floaters, or repairs, can come along and unstick it at any step
+    }
+    return belt->getSink()->getStepsUntilService ( stepNumber, limit );
+  }
+  
+  // Skips over k idle steps, in one go on a stopped belt
+  bool skipIdleSteps ( u64int k )
+  {
+    u64int moves = belt->getSlotsForSteps ( stepNumber, k );
+    
+    stepNumber += k;
+    belt->getSink()->countBlocked ( moves );
+    return belt->getSink()->getBlocking() != SINK_SLIP || rejectArrivals ( moves );
+  }
+  
+  // How many of the next "limit" steps the belt is broken down for
+  u64int getDownSteps ( u64int limit )
+  {
+    if ( !belt->hasBreakdowns() || !belt->updateBreakdowns ( stepNumber ) )
+    {
+      return 0;
+    }
+    u64int down = belt->getBeltUpAt ( stepNumber ) - stepNumber;
+    return ( down < limit ) ? down : limit;
+  }
+  
+  // Jumps over k steps with the belt down, where only the sink does anything
+  void skipDownSteps ( u64int k )
+  {
+    if ( belt->getSink() != NULL )
+    {
+      belt->getSink()->serveSteps ( stepNumber, k );
+    }
+    stepNumber += k;
+  }
+  
+  // The item type with the given name, from either list
+  ItemType *findItemType ( ascii name )
+  {
+    for ( u32int list = 0; list < 2; list++ )
+    {
+      for ( ItemType *it = ( list == 0 ) ? belt->getItemFactories() : belt->getFinishedItems(); it != NULL;
+            it = it->nextItemType )
+      {
+        if ( it->getName() == name )
+        {
+          return it;
+        }
+      }
+    }
+    return NULL;
+  }
+  
+  // Which of the targets has been reached (the first listed, if several), or -1 for none yet
+  int getReachedTarget ( RunTargets *targets )
+  {
+    for ( u32int t = 0; targets != NULL && t < targets->number; t++ )
+    {
+      ItemType *it = findItemType ( targets->name[t] );
+      if ( it != NULL && it->getNumberCollected() >= targets->count[t] )
+      {
+        return t;
+      }
+    }
+    return -1;
+  }
+  
+  // Runs the given number of steps, returning false if the line had to stop early. With targets, the run stops as
+  // soon as one of them is reached (at a step boundary, so with a fast belt a count can go a little past its target).
+  // Fast-forwarded stretches (stuck, or broken down) never take anything off the end, so never cross a target.
+  bool runSim ( u64int steps, RunTargets *targets = NULL )
+  {
+    ItemType *watched[MAX_RUN_TARGETS];
+    u64int needed[MAX_RUN_TARGETS];
+    u32int numberWatched = 0;
+    
+    for ( u32int t = 0; targets != NULL && t < targets->number; t++ )
+    {
+      watched[numberWatched] = findItemType ( targets->name[t] );
+      needed[numberWatched] = targets->count[t];
+      numberWatched += ( watched[numberWatched] != NULL );
+    }
+    
+    LINE_PROBE2 ( run_start, stepNumber, steps );
+    for (u64int i = 0; i < steps; )
+    {
+      for ( u32int t = 0; t < numberWatched; t++ )
+      {
+        if ( watched[t]->getNumberCollected() >= needed[t] )
+        {
+          LINE_PROBE1 ( run_end, stepNumber );
+          return true;
+        }
+      }
+      
+      u64int down = getDownSteps ( steps - i );
+      if ( down > 0 )
+      {
+        LINE_PROBE2 ( skip_down, stepNumber, down );
+        skipDownSteps ( down );
+        i += down;
+        continue;
+      }
+      
+      u64int idle = getIdleSteps ( steps - i );
+      if ( idle > 0 )
+      {
+        LINE_PROBE2 ( skip_idle, stepNumber, idle );
+      }
+      
+      if ( idle > 0 ? !skipIdleSteps ( idle ) : !step() )
+      {
+        return false;
+      }
+      i += ( idle > 0 ) ? idle : 1;
+      LINE_PROBE1 ( step, stepNumber );
+    }
+    LINE_PROBE1 ( run_end, stepNumber );
+    return true;
+  }
+  
+  // For long runs: runs the steps in chunks of "every" steps, printing the counts so far after each one, so a run of
+  // billions of steps can be watched as it settles into its steady state.
+  bool runSimFlushing ( u64int steps, u64int every, RunTargets *targets = NULL )
+  {
+    for ( u64int done = 0; done < steps && getReachedTarget ( targets ) < 0; )
+    {
+      u64int chunk = ( steps - done < every ) ? steps - done : every;
+      u64int before = stepNumber;
+      
+      if ( !runSim ( chunk, targets ) )
+      {
+        return false;
+      }
+      done += stepNumber - before;
+      printProgress();
+    }
+    return true;
+  }
+  
+  u64int getStepNumber ()
+  {
+    return stepNumber;
+  }
+  
+  // One line of the counts so far, with the rate per step of each
+  void printProgress ()
+  {
+    printf("After %llu steps:", (unsigned long long) stepNumber);
+    for ( u32int list = 0; list < 2; list++ )
+    {
+      ItemType *it = ( list == 0 ) ? belt->getItemFactories() : belt->getFinishedItems();
+      
+      for ( ; it != NULL; it = it->nextItemType )
+      {
+        if ( !Belt::isEmpty ( it ) )
+        {
+          printf(" %c %llu (%.6f/step)", it->getName(), (unsigned long long) it->getNumberCollected(),
+                 (double) it->getNumberCollected() / (double) ( stepNumber > 0 ? stepNumber : 1 ));
+        }
+      }
+    }
+    printf("\n");
+    fflush ( stdout ); // So the progress can be followed (or a run killed) from a log file
+  }
+  
+  void prefetch ()
+  {
+    belt->prefetch();
+  }
+  
+  Belt *getBelt ()
+  {
+    return belt;
+  }
+  
+  void printResults()
+  {
+    belt->printItemFactoryCounts();
+    
     // Now print the number of finished items
     belt->printFinishedItemCounts();
+    
+    if ( belt->getSink() != NULL )
+    {
+      belt->printSinkCounts();
+    }
+    
+    if ( belt->getNumberOfFloaters() > 0 )
+    {
+      printf("The floating workers moved %llu times\n", (unsigned long long) belt->getNumberOfMoves());
+    }
+    if ( belt->hasBreakdowns() )
+    {
+      belt->printBreakdownCounts();
+    }
+    if ( belt->canReject() )
+    {
+      belt->printRejectedCounts();
+    }
+  }
+};
+
+
+// ------ Lane engine: many replicas of one line, stepped together ------
+//
+// Runs up to ENGINE_LANES replicas of the same line configuration at once, with each replica's state held in one
+// byte "lane" of every array: slots[slot][lane], hands and timers[worker][lane].  Items are given small codes
+// rather than pointers, so a whole row of lanes is a short vector, and the arrival, belt advance, pickup, assembly
+// and placement are written as branch-free selects over the lanes, which the compiler can vectorise.
+//
+// The rules are exactly those of Worker::doWork (including its hand and overwrite-on-finish behaviour), and each
+// lane draws from its own RandomStream in the same order as ProductionLine::step(), so a lane finishes with exactly
+// the counts the ordinary engine would have given that replica.  Only the turn order at stations with more than
+// one worker is drawn lane by lane, with Belt::drawTurnOrder() itself, so the float arithmetic matches.
+//
+// Build with -O3 (or -O2 -ftree-vectorize) for the lane loops to be vectorised.
+// Assumptions: every worker gets a turn each step (see Belt::setEveryWorker), under 256 item types, under 255
+// workers at any one slot (turns are bytes, and the station engine keeps 0xff for nobody), assembly time fits in a
+// byte, and the line has a finished item (doWork() needs one).  canRun() checks them all.
+
+#define ENGINE_LANES 64
+
+// What the lane-wise engines share: the item codes, the recipe, the arrival draw, and Worker::doWork over a row of
+// lanes.  The lanes are replicas in the LaneEngine, and stations in the StationEngine.
+class LaneRules
+{
+protected:
+  u32int numberOfCodes; // Item codes: 0 is the NULL pointer, then empty item types, then the real ones
+  u8int firstRealCode; // Codes below this are empty slots as far as doWork() is concerned
+  ItemType **itemTable; // Code to item type (itemTable[0] is NULL)
+  u8int *reportOrder; // Codes in the order the Belt's item lists hold them (factories, then finished items)
+  u32int numberOfReported;
+  
+  u32int numberOfFactories;
+  probability *factoryProbability; // In the Belt's list order, for getNextItem()'s cumulative scan
+  u8int *factoryCode;
+  
+  u8int finishedCode; // The head of the finished items list, which is what doWork() builds
+  u8int *canAssemble; // [left * numberOfCodes + right], whether the finished item can be made from the two hands
+  u8int recipeA, recipeB; // When canAssemble is simply "the hands hold codes A and B" (the usual case), the codes,
+  bool recipeIsPair; // so the test is a compare rather than a table lookup, and vectorises.
+  
+  u8int codeOf ( ItemType *it )
+  {
+    for ( u32int c = 1; c < numberOfCodes; c++ )
+    {
+      if ( itemTable[c] == it )
+      {
+        return c;
+      }
+    }
+    return 0;
+  }
+  
+  void addCodes ( ItemType *it, bool wantEmpty )
+  {
+    while ( it != NULL )
+    {
+      if ( (it->getId() == (u32int) NULL_ITEM_ID) == wantEmpty && codeOf ( it ) == 0 )
+      {
+        itemTable[numberOfCodes++] = it;
+      }
+      it = it->nextItemType;
+    }
+  }
+  
+  void addReportOrder ( ItemType *it )
+  {
+    while ( it != NULL )
+    {
+      reportOrder[numberOfReported++] = codeOf ( it );
+      it = it->nextItemType;
+    }
+  }
+  
+  static u32int countList ( ItemType *it )
+  {
+    u32int n = 0;
+    for ( ; it != NULL; it = it->nextItemType )
+    {
+      n++;
+    }
+    return n;
+  }
+  
+  inline bool canAssemblePair ( u8int lh, u8int rh, bool pairOnly )
+  {
+    if ( pairOnly )
+    {
+      return ( (lh == recipeA) | (rh == recipeA) ) & ( (lh == recipeB) | (rh == recipeB) );
+    }
+    return canAssemble[lh * numberOfCodes + rh];
+  }
+  
+  // See if the canAssemble table is just "one of each of A and B in the hands", with A and B taken from the first
+  // pair that works. Otherwise (odd recipes, or items sharing ids) we stick with the table.
+  void findRecipePair ()
+  {
+    recipeIsPair = false;
+    for ( u32int pair = 1; pair < numberOfCodes * numberOfCodes; pair++ )
+    {
+      if ( canAssemble[pair] )
+      {
+        u8int l = pair / numberOfCodes, r = pair % numberOfCodes;
+        u8int candidates[3][2] = { { l, r }, { l, l }, { r, r } };
+        
+        for ( int c = 0; c < 3 && !recipeIsPair; c++ )
+        {
+          recipeA = candidates[c][0];
+          recipeB = candidates[c][1];
+          recipeIsPair = true;
+          for ( u32int t = 1; t < numberOfCodes * numberOfCodes && recipeIsPair; t++ )
+          {
+            u8int tl = t / numberOfCodes, tr = t % numberOfCodes;
+            bool formula = ( tl != 0 ) && ( tr != 0 ) && canAssemblePair ( tl, tr, true );
+            recipeIsPair = ( formula == (bool) canAssemble[t] );
+          }
+        }
+        return;
+      }
+    }
+  }
+  
+  // Replays getNextItem()'s draw, of p, returns false if nothing is hit
+  bool drawArrival ( probability p, u8int *code )
+  {
+    probability cumulative = (probability) 0.0;
+    
+    for ( u32int f = 0; f < numberOfFactories; f++ )
+    {
+      cumulative += factoryProbability[f];
+      if ( p <= cumulative )
+      {
+        *code = factoryCode[f];
+        return true;
+      }
+    }
+    printf ("Eeek, probability p (%f) did not hit any items in the probability space.\n",p);
+    return false;
+  }
+  
+  // Worker::doWork for lanes [0, n) of one worker, where each lane has its own slot and hands. Only the lanes
+  // selected by "pick" (where this worker is the one acting now) keep the results.
+  inline __attribute__((always_inline)) void doWorkLanes ( u32int n, u8int * __restrict slot, u8int * __restrict left,
+                                                          u8int * __restrict right, u8int * __restrict timer,
+                                                          const u8int * __restrict pick, bool pairOnly )
+  {
+    // Conditions are kept as all-ones/all-zeroes byte masks, so every select is plain bitwise arithmetic.
+    // The members are read into locals first: the stores through byte pointers could otherwise alias them, which
+    // stops the compiler vectorising the loop.
+    u8int real = firstRealCode, finished = finishedCode, a = recipeA, b = recipeB;
+    const u8int * __restrict table = canAssemble;
+    u32int codes = numberOfCodes;
+    
+    for ( u32int l = 0; l < n; l++ )
+    {
+      u8int it = slot[l], lh = left[l], rh = right[l], t = timer[l];
+      u8int acting = laneMask ( pick[l] != 0 );
+      
+      // If we are assembling, count down, and place the finished item if we just finished
+      u8int assembling = laneMask ( t != 0 );
+      u8int finishing = assembling & laneMask ( t == 1 );
+      
+      // Otherwise, pick up a non-empty item into an empty hand, if we aren't already holding one of them
+      u8int full = ~assembling & laneMask ( it >= real );
+      u8int takeLeft = full & laneMask ( lh == 0 ) & laneMask ( it != rh );
+      lh = laneSelect ( takeLeft, it, lh );
+      u8int takeRight = full & laneMask ( rh == 0 ) & laneMask ( it != lh );
+      rh = laneSelect ( takeRight, it, rh );
+      
+      // And start assembling if our hands hold what's needed
+      bool canStart = pairOnly ? ( ( (lh == a) | (rh == a) ) & ( (lh == b) | (rh == b) ) ) : table[lh * codes + rh];
+      u8int start = ~assembling & laneMask ( lh != 0 ) & laneMask ( rh != 0 ) & laneMask ( canStart );
+      
+      u8int out = laneSelect ( finishing, finished, laneSelect ( takeLeft | takeRight, 0, it ) );
+      u8int newTimer = laneSelect ( assembling, t - 1, start & ASSEMBLE_TIME );
+      
+      // Only lanes where this worker is acting keep the results
+      slot[l] = laneSelect ( acting, out, it );
+      left[l] = laneSelect ( acting, lh, left[l] );
+      right[l] = laneSelect ( acting, rh, right[l] );
+      timer[l] = laneSelect ( acting, newTimer, t );
+    }
+  }
+  
+  static inline u8int laneMask ( bool b )
+  {
+    return (u8int) -(u8int) b;
+  }
+  
+  static inline u8int laneSelect ( u8int mask, u8int a, u8int b )
+  {
+    return (u8int) ((a & mask) | (b & ~mask));
+  }
+  
+public:
+  
+  LaneRules ( Belt *belt )
+  {
+    ItemType *factories = belt->getItemFactories(), *finished = belt->getFinishedItems();
+    u32int listed = countList ( factories ) + countList ( finished );
+    
+    // Item codes, with the empty item types first so "is empty" is a compare rather than a lookup
+    itemTable = (ItemType **) calloc ( listed + 1, sizeof(ItemType *) );
+    numberOfCodes = 1;
+    addCodes ( factories, true );
+    addCodes ( finished, true );
+    firstRealCode = numberOfCodes;
+    addCodes ( factories, false );
+    addCodes ( finished, false );
+    
+    reportOrder = (u8int *) malloc ( listed );
+    numberOfReported = 0;
+    addReportOrder ( factories );
+    addReportOrder ( finished );
+    
+    numberOfFactories = countList ( factories );
+    factoryProbability = (probability *) malloc ( numberOfFactories * sizeof(probability) );
+    factoryCode = (u8int *) malloc ( numberOfFactories );
+    ItemType *it = factories;
+    for ( u32int f = 0; f < numberOfFactories; f++, it = it->nextItemType )
+    {
+      factoryProbability[f] = it->getGenerationProbability();
+      factoryCode[f] = codeOf ( it );
+    }
+    
+    // Work out which pairs of hands the finished item can be assembled from, using assemble() itself
+    finishedCode = codeOf ( finished );
+    canAssemble = (u8int *) calloc ( numberOfCodes * numberOfCodes, 1 );
+    for ( u32int l = 1; l < numberOfCodes; l++ )
+    {
+      for ( u32int r = 1; r < numberOfCodes; r++ )
+      {
+        ItemType *hands[] = { itemTable[l], itemTable[r], NULL };
+        canAssemble[l * numberOfCodes + r] = ( finished->assemble ( hands ) != NULL );
+      }
+    }
+    findRecipePair();
+  }
+  
+  // Usable if the line fits the byte lanes, and nothing is watching for the events they don't report
+  static bool canRun ( Belt *belt )
+  {
+    u32int items = countList ( belt->getItemFactories() ) + countList ( belt->getFinishedItems() );
+    u32int mostAtStation = 0;
+    
+    for ( u32int s = 0; s < belt->getNumberOfStations(); s++ )
+    {
+      u32int atStation = belt->getStationFirst ( s + 1 ) - belt->getStationFirst ( s );
+      mostAtStation = ( atStation > mostAtStation ) ? atStation : mostAtStation;
+    }
+    return belt->isEveryWorker() && belt->getFinishedItems() != NULL && mostAtStation < 255 && items < 256 && belt->getNumberOfWorkers() > 0 && !belt->isLoop() &&
+           belt->isUnitSpeed() && belt->getSink() == NULL && belt->getNumberOfFeeders() == 0 &&
+           belt->getNumberOfFloaters() == 0 && !belt->hasBreakdowns() && !belt->hasLongItems() &&
+           belt->getNumberOfSlots() > 0 && ASSEMBLE_TIME < 256 && belt->hasPlainWorkers() && !LineObserver::enabled;
+  }
+  
+  // Results per item type, in the order the Belt lists them
+  u32int getNumberReported ()
+  {
+    return numberOfReported;
+  }
+  
+  ItemType *getReportedItem ( u32int n )
+  {
+    return itemTable[reportOrder[n]];
+  }
+  
+  ~LaneRules()
+  {
+    free ( itemTable );
+    free ( reportOrder );
+    free ( factoryProbability );
+    free ( factoryCode );
+    free ( canAssemble );
+  }
+};
+
+class LaneEngine : public LaneRules
+{
+private:
+  u32int numberOfSlots;
+  u32int numberOfWorkers;
+  
+  u32int numberOfStations;
+  u32int *stationSlot;
+  u32int *stationFirst; // Station s has workers stationWorkers[stationFirst[s]] .. [stationFirst[s + 1] - 1]
+  u32int *stationWorkers;
+  probability *stationWeights; // The work probability of each of stationWorkers, for drawing turn orders
+  
+  // The state, lane-wise
+  u8int (*slots)[ENGINE_LANES];
+  u8int (*leftHands)[ENGINE_LANES];
+  u8int (*rightHands)[ENGINE_LANES];
+  u8int (*timers)[ENGINE_LANES];
+  u8int (*turnOrder)[ENGINE_LANES]; // [stationFirst[s] + k][lane], the local index of station s's k'th worker to act
+  u64int (*counts)[ENGINE_LANES]; // [code][lane], items collected off the end of the belt
+  u8int arrivals[ENGINE_LANES];
+  u8int active[ENGINE_LANES]; // Lanes still running, a lane stops (as runSim() does) if no item can be generated
+  u32int *turnPicks; // Scratch for drawing a turn order
+  
+  // Worker::isReadyToAct, for one lane
+  bool isReadyToAct ( u32int w, u32int lane )
+  {
+    u8int lh = leftHands[w][lane], rh = rightHands[w][lane];
+    return timers[w][lane] != 0 || ( lh != 0 && rh != 0 && canAssemblePair ( lh, rh, recipeIsPair ) );
+  }
+  
+  // Draws the turn order at a station with several workers, in each lane where Belt::workStations() would visit
+  // it (so the lane draws the same numbers). Elsewhere doWork() changes nothing, so any order will do.
+  void drawTurnOrders ( u32int st, u32int lanes, RandomStream *streams )
+  {
+    u32int s = stationSlot[st], first = stationFirst[st], atStation = stationFirst[st + 1] - first;
+    
+    for ( u32int l = 0; l < lanes; l++ )
+    {
+      bool hasWork = active[l] && slots[s][l] >= firstRealCode;
+      for ( u32int j = 0; j < atStation && active[l] && !hasWork; j++ )
+      {
+        hasWork = isReadyToAct ( stationWorkers[first + j], l );
+      }
+      
+      if ( hasWork )
+      {
+        setRandomStream ( &streams[l] );
+        Belt::drawTurnOrder ( &stationWeights[first], atStation, turnPicks );
+        for ( u32int k = 0; k < atStation; k++ )
+        {
+          turnOrder[first + k][l] = turnPicks[k];
+        }
+      }
+    }
+    setRandomStream ( NULL );
+  }
+  
+  // Replays getNextItem()'s draw for one lane, returns false if nothing is hit
+  bool drawArrival ( u32int lane, RandomStream *rs )
+  {
+    return LaneRules::drawArrival ( rs->nextProbability(), &arrivals[lane] );
+  }
+  
+  // Worker::doWork for all lanes of one worker, at slot s. "pick" selects the lanes where this worker is the one
+  // acting now (all of them, when the worker is alone at the slot).
+  void doWork ( u32int w, u32int s, u8int *pick )
+  {
+    // Give the compiler a copy of the loop for each kind of recipe, the pair test vectorises, the table doesn't
+    if ( recipeIsPair )
+    {
+      doWorkLanes ( ENGINE_LANES, slots[s], leftHands[w], rightHands[w], timers[w], pick, true );
+    }
+    else
+    {
+      doWorkLanes ( ENGINE_LANES, slots[s], leftHands[w], rightHands[w], timers[w], pick, false );
+    }
+  }
+  
+public:
+  
+  LaneEngine ( Belt *belt ) : LaneRules ( belt )
+  {
+    // The stations, straight from the Belt's slot to worker index
+    numberOfSlots = belt->getNumberOfSlots();
+    numberOfWorkers = belt->getNumberOfWorkers();
+    numberOfStations = belt->getNumberOfStations();
+    stationWeights = (probability *) malloc ( numberOfWorkers * sizeof(probability) );
+    stationSlot = (u32int *) malloc ( numberOfStations * sizeof(u32int) );
+    stationFirst = (u32int *) malloc ( (numberOfStations + 1) * sizeof(u32int) );
+    stationWorkers = (u32int *) malloc ( numberOfWorkers * sizeof(u32int) );
+    
+    for ( u32int st = 0; st < numberOfStations; st++ )
+    {
+      stationFirst[st] = belt->getStationFirst ( st );
+      stationSlot[st] = belt->getStationSlot ( st );
+    }
+    stationFirst[numberOfStations] = belt->getStationFirst ( numberOfStations );
+    for ( u32int n = 0; n < numberOfWorkers; n++ )
+    {
+      stationWorkers[n] = belt->getStationWorker ( n );
+      stationWeights[n] = belt->getWorker ( stationWorkers[n] )->getWorkProbability();
+    }
+    
+    slots = (u8int (*)[ENGINE_LANES]) calloc ( numberOfSlots, ENGINE_LANES );
+    leftHands = (u8int (*)[ENGINE_LANES]) calloc ( numberOfWorkers, ENGINE_LANES );
+    rightHands = (u8int (*)[ENGINE_LANES]) calloc ( numberOfWorkers, ENGINE_LANES );
+    timers = (u8int (*)[ENGINE_LANES]) calloc ( numberOfWorkers, ENGINE_LANES );
+    turnOrder = (u8int (*)[ENGINE_LANES]) calloc ( numberOfWorkers, ENGINE_LANES );
+    counts = (u64int (*)[ENGINE_LANES]) calloc ( numberOfCodes, ENGINE_LANES * sizeof(u64int) );
+    turnPicks = (u32int *) malloc ( numberOfWorkers * sizeof(u32int) );
+    memset ( arrivals, 0, sizeof(arrivals) );
+    memset ( active, 0, sizeof(active) );
+  }
+  
+  // Runs "lanes" replicas (up to ENGINE_LANES) for the given number of steps, lane l drawing from streams[l]
+  void run ( u32int lanes, u64int steps, RandomStream *streams )
+  {
+    u32int lastSlot = numberOfSlots - 1;
+    
+    memset ( slots, 0, numberOfSlots * ENGINE_LANES );
+    memset ( leftHands, 0, numberOfWorkers * ENGINE_LANES );
+    memset ( rightHands, 0, numberOfWorkers * ENGINE_LANES );
+    memset ( timers, 0, numberOfWorkers * ENGINE_LANES );
+    memset ( counts, 0, numberOfCodes * ENGINE_LANES * sizeof(u64int) );
+    for ( u32int l = 0; l < ENGINE_LANES; l++ )
+    {
+      active[l] = ( l < lanes );
+    }
+    for ( u32int st = 0; st < numberOfStations; st++ )
+    {
+      for ( u32int k = stationFirst[st]; k < stationFirst[st + 1]; k++ )
+      {
+        memset ( turnOrder[k], k - stationFirst[st], ENGINE_LANES ); // Any order will do to start with
+      }
+    }
+    
+    u8int everyLane[ENGINE_LANES];
+    u8int pick[ENGINE_LANES];
+    memset ( everyLane, 1, sizeof(everyLane) );
+    
+    for ( u64int i = 0; i < steps; i++ )
+    {
+      // The arriving item, lane by lane
+      for ( u32int l = 0; l < lanes; l++ )
+      {
+        if ( active[l] && !drawArrival ( l, &streams[l] ) )
+        {
+          printf("error: getNextItem failed to produce anything\n");
+          active[l] = 0;
+        }
+      }
+      
+      // Count whatever comes off the end of the belt, in the lanes still running
+      for ( u32int c = 1; c < numberOfCodes; c++ )
+      {
+        for ( u32int l = 0; l < ENGINE_LANES; l++ )
+        {
+          counts[c][l] += active[l] & ( slots[lastSlot][l] == c );
+        }
+      }
+      
+      // Advance the belt, and put the new arrivals in the entry slot
+      memmove ( slots[1], slots[0], lastSlot * ENGINE_LANES );
+      memcpy ( slots[0], arrivals, ENGINE_LANES );
+      
+      // Every worker takes a turn.  Stations work on separate slots, so only the order within a station matters.
+      for ( u32int st = 0; st < numberOfStations; st++ )
+      {
+        u32int first = stationFirst[st], atStation = stationFirst[st + 1] - first;
+        
+        if ( atStation == 1 )
+        {
+          doWork ( stationWorkers[first], stationSlot[st], everyLane );
+          continue;
+        }
+        
+        drawTurnOrders ( st, lanes, streams );
+        for ( u32int k = 0; k < atStation; k++ )
+        {
+          for ( u32int local = 0; local < atStation; local++ )
+          {
+            for ( u32int l = 0; l < ENGINE_LANES; l++ )
+            {
+              pick[l] = ( turnOrder[first + k][l] == local );
+            }
+            doWork ( stationWorkers[first + local], stationSlot[st], pick );
+          }
+        }
+      }
+    }
+  }
+  
+  // Results for each lane, per item type, in the order the Belt lists them (see getReportedItem)
+  u64int getReportedCount ( u32int n, u32int lane )
+  {
+    return counts[reportOrder[n]][lane];
+  }
+  
+  ~LaneEngine()
+  {
+    free ( stationWeights );
+    free ( stationSlot );
+    free ( stationFirst );
+    free ( stationWorkers );
+    free ( slots );
+    free ( leftHands );
+    free ( rightHands );
+    free ( timers );
+    free ( turnOrder );
+    free ( counts );
+    free ( turnPicks );
+  }
+};
+
+
+// ------ Station engine: one line, with its stations stepped together ------
+//
+// Every station only touches its own slot, so once the belt has moved, the workers at all the stations can take
+// their turns at once.  The StationEngine runs one replica with the stations as the lanes.  Each step it gathers
+// the busy stations (those Belt::workStations() would visit, with something in the slot or a worker ready to act)
+// into lanes, each station's workers in the order they take their turns, so turn k is one lane-wise pass of the
+// LaneEngine's rules over row k, and then puts them back.  The stations with nothing to do are left out, as on a
+// long line which has not filled yet they are most of them.  The belt is a ring of item codes, so moving it along
+// is a change of index.  This speeds up a single long line, where the LaneEngine only helps with many replicas.
+//
+// It draws the same numbers in the same order as ProductionLine::step(): the arrival, then the turn orders at the
+// busy stations with more than one worker, in slot order, so the counts come out exactly as the ordinary engine's.
+// The lines it can run are those of LaneRules::canRun.
+
+#define STATION_LANE_BLOCK 32 // The lanes are worked in blocks of this many, padded with lanes where nobody acts
+
+class StationEngine : public LaneRules
+{
+private:
+  u32int numberOfSlots;
+  u8int *slots; // A ring: slot i is at slots[(ringStart + i) % numberOfSlots]
+  u32int ringStart;
+  
+  u32int numberOfStations;
+  u32int numberOfLanes; // The stations, padded to a whole number of blocks
+  u32int maxAtStation; // The most workers at any one station
+  u32int *stationSlot;
+  u32int *stationFirst; // As in the LaneEngine, for the weights of each station's workers
+  probability *stationWeights;
+  
+  // The state, station by station: [station * maxAtStation + j] for the j'th worker there
+  u8int *leftHands;
+  u8int *rightHands;
+  u8int *timers;
+  u8int *ready; // [station], a worker there has work to do even with nothing in the slot
+  u32int *turnPicks; // Scratch for drawing a turn order
+  u64int *counts; // [code], items collected off the end of the belt
+  
+  // The busy stations of this step, gathered into lanes: row k holds the worker taking turn k at each
+  u32int *laneStation; // [lane]
+  u32int *laneSlot; // [lane], where the station's slot is in the ring this step
+  u8int *laneItems; // [lane]
+  u8int *laneLeft; // [k * numberOfLanes + lane]
+  u8int *laneRight;
+  u8int *laneTimers;
+  u8int *laneActs; // [k * numberOfLanes + lane], whether the station has a k'th worker
+  u8int *laneWorker; // [k * numberOfLanes + lane], which of its workers that is
+  
+  // Gathers the busy stations into lanes, drawing their turn orders, and returns how many there are
+  u32int gatherBusy ()
+  {
+    u32int used = 0;
+    
+    for ( u32int st = 0; st < numberOfStations; st++ )
+    {
+      u32int p = ringStart + stationSlot[st];
+      p = ( p >= numberOfSlots ) ? p - numberOfSlots : p;
+      if ( slots[p] < firstRealCode && !ready[st] )
+      {
+        continue; // doWork() would change nothing here
+      }
+      
+      u32int first = stationFirst[st], atStation = stationFirst[st + 1] - first;
+      if ( atStation > 1 )
+      {
+        Belt::drawTurnOrder ( &stationWeights[first], atStation, turnPicks );
+      }
+      else
+      {
+        turnPicks[0] = 0;
+      }
+      laneStation[used] = st;
+      laneSlot[used] = p;
+      laneItems[used] = slots[p];
+      for ( u32int k = 0; k < maxAtStation; k++ )
+      {
+        u32int lane = k * numberOfLanes + used;
+        
+        laneActs[lane] = ( k < atStation );
+        if ( k < atStation )
+        {
+          u32int w = st * maxAtStation + turnPicks[k];
+          laneWorker[lane] = turnPicks[k];
+          laneLeft[lane] = leftHands[w];
+          laneRight[lane] = rightHands[w];
+          laneTimers[lane] = timers[w];
+        }
+      }
+      used++;
+    }
+    
+    // Nobody acts in the lanes padding out the last block
+    for ( u32int l = used; l % STATION_LANE_BLOCK != 0; l++ )
+    {
+      for ( u32int k = 0; k < maxAtStation; k++ )
+      {
+        laneActs[k * numberOfLanes + l] = 0;
+      }
+    }
+    return used;
+  }
+  
+  // Worker::doWork for the workers taking turn k at the first "used" lanes, a block at a time (a fixed count, so the
+  // compiler vectorises it without a remainder loop)
+  void doTurn ( u32int k, u32int used )
+  {
+    u32int row = k * numberOfLanes;
+    
+    for ( u32int b = 0; b < used; b += STATION_LANE_BLOCK )
+    {
+      if ( recipeIsPair )
+      {
+        doWorkLanes ( STATION_LANE_BLOCK, &laneItems[b], &laneLeft[row + b], &laneRight[row + b], &laneTimers[row + b],
+                      &laneActs[row + b], true );
+      }
+      else
+      {
+        doWorkLanes ( STATION_LANE_BLOCK, &laneItems[b], &laneLeft[row + b], &laneRight[row + b], &laneTimers[row + b],
+                      &laneActs[row + b], false );
+      }
+    }
+  }
+  
+  // Puts the lanes back, noting which stations have a worker ready for the next step
+  void scatterBusy ( u32int used )
+  {
+    for ( u32int l = 0; l < used; l++ )
+    {
+      u32int st = laneStation[l];
+      bool readyNext = false;
+      
+      slots[laneSlot[l]] = laneItems[l];
+      for ( u32int k = 0; k < maxAtStation; k++ )
+      {
+        u32int lane = k * numberOfLanes + l, w = st * maxAtStation + laneWorker[lane];
+        u8int lh = laneLeft[lane], rh = laneRight[lane];
+        
+        if ( laneActs[lane] )
+        {
+          leftHands[w] = lh;
+          rightHands[w] = rh;
+          timers[w] = laneTimers[lane];
+          readyNext |= ( laneTimers[lane] != 0 ) || ( lh != 0 && rh != 0 && canAssemblePair ( lh, rh, recipeIsPair ) );
+        }
+      }
+      ready[st] = readyNext;
+    }
+  }
+  
+public:
+  
+  StationEngine ( Belt *belt ) : LaneRules ( belt )
+  {
+    numberOfSlots = belt->getNumberOfSlots();
+    numberOfStations = belt->getNumberOfStations();
+    numberOfLanes = ( numberOfStations + STATION_LANE_BLOCK - 1 ) / STATION_LANE_BLOCK * STATION_LANE_BLOCK;
+    
+    u32int numberOfWorkers = belt->getNumberOfWorkers();
+    stationSlot = (u32int *) malloc ( numberOfStations * sizeof(u32int) );
+    stationFirst = (u32int *) malloc ( (numberOfStations + 1) * sizeof(u32int) );
+    stationWeights = (probability *) malloc ( numberOfWorkers * sizeof(probability) );
+    
+    maxAtStation = 0;
+    for ( u32int st = 0; st <= numberOfStations; st++ )
+    {
+      stationFirst[st] = belt->getStationFirst ( st );
+      if ( st == numberOfStations )
+      {
+        break;
+      }
+      stationSlot[st] = belt->getStationSlot ( st );
+      
+      u32int atStation = belt->getStationFirst ( st + 1 ) - stationFirst[st];
+      maxAtStation = ( atStation > maxAtStation ) ? atStation : maxAtStation;
+    }
+    for ( u32int n = 0; n < numberOfWorkers; n++ )
+    {
+      stationWeights[n] = belt->getWorker ( belt->getStationWorker ( n ) )->getWorkProbability();
+    }
+    
+    slots = (u8int *) calloc ( numberOfSlots, 1 );
+    ringStart = 0;
+    leftHands = (u8int *) calloc ( numberOfStations * maxAtStation, 1 );
+    rightHands = (u8int *) calloc ( numberOfStations * maxAtStation, 1 );
+    timers = (u8int *) calloc ( numberOfStations * maxAtStation, 1 );
+    ready = (u8int *) calloc ( numberOfStations, 1 );
+    turnPicks = (u32int *) malloc ( ( maxAtStation + 1 ) * sizeof(u32int) ); // + 1 for a line with no workers
+    counts = (u64int *) calloc ( numberOfCodes, sizeof(u64int) );
+    
+    laneStation = (u32int *) malloc ( numberOfLanes * sizeof(u32int) );
+    laneSlot = (u32int *) malloc ( numberOfLanes * sizeof(u32int) );
+    laneItems = (u8int *) calloc ( numberOfLanes, 1 );
+    laneLeft = (u8int *) calloc ( maxAtStation * numberOfLanes, 1 );
+    laneRight = (u8int *) calloc ( maxAtStation * numberOfLanes, 1 );
+    laneTimers = (u8int *) calloc ( maxAtStation * numberOfLanes, 1 );
+    laneActs = (u8int *) calloc ( maxAtStation * numberOfLanes, 1 );
+    laneWorker = (u8int *) calloc ( maxAtStation * numberOfLanes, 1 );
+  }
+  
+  // One step, as ProductionLine::step(), drawing from the current random stream. Returns false if no item could be
+  // generated.
+  bool step ()
+  {
+    u8int arrival;
+    
+    if ( !drawArrival ( getRandomNumber(), &arrival ) )
+    {
+      printf("error: getNextItem failed to produce anything\n");
+      return false;
+    }
+    
+    // Count whatever comes off the end, then move the belt along: the last slot comes round to be the entry slot
+    u32int last = ( ringStart == 0 ) ? numberOfSlots - 1 : ringStart - 1;
+    counts[slots[last]]++;
+    ringStart = last;
+    slots[ringStart] = arrival;
+    
+    u32int used = gatherBusy();
+    for ( u32int k = 0; k < maxAtStation; k++ )
+    {
+      doTurn ( k, used );
+    }
+    scatterBusy ( used );
+    return true;
+  }
+  
+  // Runs the given number of steps, returning false if the line had to stop early
+  bool run ( u64int steps )
+  {
+    for ( u64int i = 0; i < steps; i++ )
+    {
+      if ( !step() )
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+  
+  // Items of the n'th reported type collected so far (see getReportedItem)
+  u64int getReportedCount ( u32int n )
+  {
+    return counts[reportOrder[n]];
+  }
+  
+  ~StationEngine()
+  {
+    free ( slots );
+    free ( stationSlot );
+    free ( stationFirst );
+    free ( stationWeights );
+    free ( leftHands );
+    free ( rightHands );
+    free ( timers );
+    free ( ready );
+    free ( turnPicks );
+    free ( counts );
+    free ( laneStation );
+    free ( laneSlot );
+    free ( laneItems );
+    free ( laneLeft );
+    free ( laneRight );
+    free ( laneTimers );
+    free ( laneActs );
+    free ( laneWorker );
+  }
+};
+
+#define NUMBER_OF_STEPS 100 
+
+#define MAX_LINE_FEEDERS 8
+#define MAX_LINE_FLOATERS 8
+
+// Variations on the layout of the line, which can be set from the command line
+struct LineOptions
+{
+  bool loop; // Make the belt a loop (see Belt::setLoop)
+  int outputSlot; // and take finished items off it here (-1 for nowhere)
+  u32int speedSlots, speedSteps; // The belt moves speedSlots slots every speedSteps steps (see Belt::setSpeed)
+  u32int sinkCapacity; // Items off the end go to an OutputSink holding this many (0 for no sink)
+  u32int sinkItems, sinkSteps; // which takes sinkItems away every sinkSteps steps
+  bool sinkSlip; // and the belt slips, rather than stopping, when it is full
+  u32int numberOfFeeders; // Side feeders: feeder f puts items onto slot feederSlot[f], with probability
+  u32int feederSlot[MAX_LINE_FEEDERS]; // feederRate[f] each slot move, one of the item names in feederItems[f]
+  probability feederRate[MAX_LINE_FEEDERS]; // (each equally likely, so "AAB" is two A's to every B)
+  const char *feederItems[MAX_LINE_FEEDERS];
+  u32int numberOfFloaters; // Floating workers, starting at floaterSlot[f] (see Belt::addFloater)
+  u32int floaterSlot[MAX_LINE_FLOATERS];
+  ReassignPolicy reassignPolicy;
+  u32int reassignInterval;
+  u32int moveCost;
+  u32int beltMtbf, beltMttr; // Mean steps between breakdowns, and to repair, of the belt (see Belt::setBreakdowns)
+  u32int stationMtbf, stationMttr; // and of each station
+  u32int productSize; // Slots a finished P takes up (0 or 1 for one)
+  u32int beltLength; // Slots on the belt (0 for the challenge's 5), with the stations spread along it
+  u32int numberOfStations; // Stations, each a pair of workers (0 for the challenge's 3)
+  bool compress; // Keep only the items in flight between stations, not every slot (see Belt::stepCompressed)
+  bool synthetic; // Build a generated factory rather than the challenge's line (see buildSyntheticLine)
+  u64int syntheticSeed; // the one this seed picks
+  u32int syntheticItems; // with this many types of component (0 for the default)
+  bool setWeights; // Arrival weights for A, B and gaps, in itemWeights (rather than the challenge's equal ones)
+  u32int itemWeights[3];
+  u32int crew; // Workers at each station (0 for the challenge's pair)
+  bool everyWorker; // Every worker gets a turn each step, rather than one drawn at random (see Belt::setEveryWorker),
+                    // as they always do in a generated factory, which would hardly move otherwise
+};
+
+#define MAX_STATION_CREW 64
+
+#define SYNTHETIC_COMPONENT_NAMES "ABCDEFGHIJKLMNOQRSTUVWXYZ0123456789" // Not P, which is the final product
+#define SYNTHETIC_PART_NAMES "abcdefghijklmnopqrstuvwxyz" // The part-built products on the way to it
+#define DEFAULT_SYNTHETIC_ITEMS 24
+#define DEFAULT_SYNTHETIC_STATIONS 1000
+
+// The number of stations and length of belt the options ask for, filling in the defaults
+u32int getLineStations ( LineOptions *lineOptions )
+{
+  if ( lineOptions->numberOfStations > 0 )
+  {
+    return lineOptions->numberOfStations;
+  }
+  return lineOptions->synthetic ? DEFAULT_SYNTHETIC_STATIONS : 3;
+}
+
+u32int getLineLength ( LineOptions *lineOptions )
+{
+  if ( lineOptions->beltLength > 0 )
+  {
+    return lineOptions->beltLength;
+  }
+  return lineOptions->synthetic ? 3 * getLineStations ( lineOptions ) + 2 : 5;
+}
+
+// The command line options giving "lo", leaving out those at their defaults
+void formatLineOptions ( LineOptions *lo, char *buf, size_t size )
+{
+  size_t n = 0;
+  
+#define FORMAT_OPTION(...) { n += snprintf ( buf + n, ( n < size ) ? size - n : 0, __VA_ARGS__ ); }
+  buf[0] = '\0';
+  if ( lo->synthetic )
+  {
+    FORMAT_OPTION(" --synthetic %llu", (unsigned long long) lo->syntheticSeed);
+    if ( lo->syntheticItems > 0 )
+    {
+      FORMAT_OPTION(" --synthetic-items %u", lo->syntheticItems);
+    }
+  }
+  if ( lo->beltLength > 0 )
+  {
+    FORMAT_OPTION(" --belt-length %u", lo->beltLength);
+  }
+  if ( lo->numberOfStations > 0 )
+  {
+    FORMAT_OPTION(" --stations %u", lo->numberOfStations);
+  }
+  if ( lo->crew > 0 )
+  {
+    FORMAT_OPTION(" --crew %u", lo->crew);
+  }
+  if ( lo->setWeights )
+  {
+    FORMAT_OPTION(" --weights %u/%u/%u", lo->itemWeights[0], lo->itemWeights[1], lo->itemWeights[2]);
+  }
+  if ( lo->loop )
+  {
+    FORMAT_OPTION(" --loop --output-slot %d", lo->outputSlot);
+  }
+  if ( lo->speedSlots != 1 || lo->speedSteps != 1 )
+  {
+    FORMAT_OPTION(" --speed %u/%u", lo->speedSlots, lo->speedSteps);
+  }
+  if ( lo->sinkCapacity > 0 )
+  {
+    FORMAT_OPTION(" --sink %u --sink-rate %u/%u%s", lo->sinkCapacity, lo->sinkItems, lo->sinkSteps,
+                  lo->sinkSlip ? " --slip" : "");
+  }
+  for ( u32int f = 0; f < lo->numberOfFeeders; f++ )
+  {
+    FORMAT_OPTION(" --feeder %u:%g:%s", lo->feederSlot[f], lo->feederRate[f], lo->feederItems[f]);
+  }
+  for ( u32int f = 0; f < lo->numberOfFloaters; f++ )
+  {
+    FORMAT_OPTION(" --floater %u", lo->floaterSlot[f]);
+  }
+  if ( lo->numberOfFloaters > 0 )
+  {
+    FORMAT_OPTION(" --reassign %s --reassign-every %u --move-cost %u",
+                  ( lo->reassignPolicy == reassignFromStarved ) ? "starved" : "blocked", lo->reassignInterval,
+                  lo->moveCost);
+  }
+  if ( lo->beltMtbf > 0 )
+  {
+    FORMAT_OPTION(" --belt-breakdowns %u/%u", lo->beltMtbf, lo->beltMttr);
+  }
+  if ( lo->stationMtbf > 0 )
+  {
+    FORMAT_OPTION(" --station-breakdowns %u/%u", lo->stationMtbf, lo->stationMttr);
+  }
+  if ( lo->productSize > 1 )
+  {
+    FORMAT_OPTION(" --product-size %u", lo->productSize);
+  }
+  if ( lo->compress )
+  {
+    FORMAT_OPTION(" --compress");
+  }
+  if ( lo->everyWorker )
+  {
+    FORMAT_OPTION(" --every-worker");
+  }
+#undef FORMAT_OPTION
+}
+
+ItemType *findItemFactory ( Belt *belt, ascii name )
+{
+  for ( ItemType *it = belt->getItemFactories(); it != NULL; it = it->nextItemType )
+  {
+    if ( it->getName() == name )
+    {
+      return it;
+    }
+  }
+  return NULL;
+}
+
+// The parts of a line common to every layout: the belt's variations, from the command line, and the line around it
+ProductionLine *finishLine ( Belt *belt, LineOptions *lineOptions )
+{
+  belt->setLoop ( lineOptions->loop, lineOptions->outputSlot );
+  belt->setSpeed ( lineOptions->speedSlots, lineOptions->speedSteps );
+  if ( lineOptions->sinkCapacity > 0 )
+  {
+    belt->setSink ( new OutputSink ( lineOptions->sinkCapacity, lineOptions->sinkItems, lineOptions->sinkSteps,
+                                     lineOptions->sinkSlip ? SINK_SLIP : SINK_STOP ) );
+  }
+  
+  belt->setBreakdowns ( lineOptions->beltMtbf, lineOptions->beltMttr, lineOptions->stationMtbf, lineOptions->stationMttr );
+  belt->setEveryWorker ( lineOptions->everyWorker || lineOptions->synthetic );
+  
+  for ( u32int f = 0; f < lineOptions->numberOfFloaters; f++ )
+  {
+    belt->addFloater ( new Worker(), lineOptions->floaterSlot[f], lineOptions->reassignPolicy,
+                       lineOptions->reassignInterval, lineOptions->moveCost );
+  }
+  
+  for ( u32int f = 0; f < lineOptions->numberOfFeeders; f++ )
+  {
+    Feeder *feeder = new Feeder ( lineOptions->feederSlot[f], lineOptions->feederRate[f] );
+    
+    for ( const char *name = lineOptions->feederItems[f]; *name != '\0'; name++ )
+    {
+      feeder->addItem ( findItemFactory ( belt, *name ), 1 );
+    }
+    belt->addFeeder ( feeder );
+  }
+  
+  ProductionLine *sim = new ProductionLine();
+  
+  // the production line class remembers to delete its belt (if present) when destroyed.
+  sim->addBelt ( belt );
+  
+  return sim;
+}
+
+// A component for a recipe, each as likely as it is to arrive, and never one an earlier recipe took (or the
+// selective workers making that, further up the belt, could take every one of them): the components taken have
+// their weights[] set to 0, and *total is what is left.
+ItemType *pickSyntheticComponent ( RandomStream *rs, ItemType **components, u32int *weights, u32int *total )
+{
+  u32int pick = rs->next() % *total;
+  u32int c = 0;
+  
+  while ( pick >= weights[c] )
+  {
+    pick -= weights[c++];
+  }
+  *total -= weights[c];
+  weights[c] = 0;
+  return components[c];
+}
+
+// Builds a generated factory, for stress and scaling runs: the same seed always gives the same factory (whatever
+// the replica, drawing from its own stream, not the replica's), so runs on it can be repeated and compared.
+//  - lineOptions->syntheticItems types of component arrive at the belt's entry, with weights falling off with
+//    their rank as a power law (of a random exponent, from 0.6 to 1.4), so a few are common and most are rare,
+//  - under half as many part-built products (and fewer than the stations), each from two inputs (workers have two
+//    hands): a component and either another component or an earlier part, so the recipes are several levels deep
+//    (the components picked as often as they arrive, as a factory would order them),
+//  - and P, the final product, from the last parts made (or components, if too few are left over),
+//  - the stations a little unevenly spread along the belt, in recipe order (the first ones making the first parts,
+//    the last ones P, every recipe with at least one station), with one to three workers each,
+//  - the workers of differing weights and assembly times (2 to 8 steps), using up what they assemble, and nine in
+//    ten of them selective, only picking up what they need (the rest pick up anything, as the challenge's workers do, and
+//    are soon stuck with it), though the first at each station always is.
+// Every component and part goes into one recipe at most, made further down the belt than anything it needs, so every
+// input can reach the workers who need it (past the others, who only need their own), and every factory can make P.
+ProductionLine *buildSyntheticLine ( LineOptions *lineOptions )
+{
+  RandomStream rs ( lineOptions->syntheticSeed, 0 );
+  u32int numberOfComponents = ( lineOptions->syntheticItems > 0 ) ? lineOptions->syntheticItems : DEFAULT_SYNTHETIC_ITEMS;
+  u32int numberOfParts = ( numberOfComponents - 1 ) / 2;
+  ItemType *components[sizeof(SYNTHETIC_COMPONENT_NAMES)], *parts[sizeof(SYNTHETIC_PART_NAMES)];
+  u32int rank[sizeof(SYNTHETIC_COMPONENT_NAMES)], weights[sizeof(SYNTHETIC_COMPONENT_NAMES)];
+  u32int length = getLineLength ( lineOptions ), stations = getLineStations ( lineOptions );
+  
+  numberOfParts = ( numberOfParts > strlen ( SYNTHETIC_PART_NAMES ) ) ? strlen ( SYNTHETIC_PART_NAMES ) : numberOfParts;
+  numberOfParts = ( numberOfParts >= stations ) ? stations - 1 : numberOfParts; // Leaving a station for P
+  
+  // Which component is how common, shuffled so the common ones aren't always the same names
+  for ( u32int c = 0; c < numberOfComponents; c++ )
+  {
+    rank[c] = c;
+  }
+  for ( u32int c = numberOfComponents - 1; c > 0; c-- )
+  {
+    u32int other = rs.next() % (c + 1), r = rank[c];
+    rank[c] = rank[other];
+    rank[other] = r;
+  }
+  
+  Belt *belt = new Belt ( length, lineOptions->compress );
+  double skew = 0.6 + 0.8 * rs.nextProbability();
+  u32int totalWeight = 0;
+  
+  for ( u32int c = 0; c < numberOfComponents; c++ )
+  {
+    u32int weight = (u32int) ( 1000.0 / pow ( (double) (rank[c] + 1), skew ) );
+    
+    weights[c] = ( weight > 0 ) ? weight : 1;
+    components[c] = new ItemType ( SYNTHETIC_COMPONENT_NAMES[c] );
+    belt->addItemFactory ( components[c], weights[c] );
+    totalWeight += weights[c];
+  }
+  // And gaps, from a fifth to four fifths of the slots
+  belt->addItemFactory ( new ItemType(), (u32int) ( totalWeight * ( 0.25 + 3.75 * rs.nextProbability() ) ) );
+  
+  // The parts, each taking one of those made before it (not yet used) about half the time.  Each takes at most two
+  // of the components, leaving at least one for P (which has at least one part left over), so they never run out.
+  ItemType *unused[sizeof(SYNTHETIC_PART_NAMES)];
+  u32int numberUnused = 0, available[sizeof(SYNTHETIC_COMPONENT_NAMES)], totalAvailable = totalWeight;
+  
+  memcpy ( available, weights, numberOfComponents * sizeof(u32int) );
+  
+  for ( u32int i = 0; i < numberOfParts; i++ )
+  {
+    ItemType *inputs[] = { NULL, NULL, NULL };
+    
+    if ( numberUnused > 0 && rs.nextProbability() < 0.5 )
+    {
+      u32int u = rs.next() % numberUnused;
+      inputs[0] = unused[u];
+      unused[u] = unused[--numberUnused];
+    }
+    else
+    {
+      inputs[0] = pickSyntheticComponent ( &rs, components, available, &totalAvailable );
+    }
+    inputs[1] = pickSyntheticComponent ( &rs, components, available, &totalAvailable );
+    
+    parts[i] = new ItemType ( SYNTHETIC_PART_NAMES[i] );
+    parts[i]->setComponentsRequired ( inputs );
+    belt->addFinishedItem ( parts[i] );
+    unused[numberUnused++] = parts[i];
+  }
+  
+  // P is added last, so it heads the finished items, and is what plain workers (floaters, say) build. Any parts
+  // left over go off the end of the belt, as by-products.
+  ItemType *itemP = new ItemType ( 'P' );
+  ItemType *inputs[] = { NULL, NULL, NULL };
+  
+  inputs[0] = ( numberUnused > 0 ) ? unused[--numberUnused] : pickSyntheticComponent ( &rs, components, available, &totalAvailable );
+  inputs[1] = ( numberUnused > 0 ) ? unused[--numberUnused] : pickSyntheticComponent ( &rs, components, available, &totalAvailable );
+  itemP->setComponentsRequired ( inputs );
+  itemP->setSize ( lineOptions->productSize );
+  belt->addFinishedItem ( itemP );
+  
+  int spacing = (int) ( length / (stations + 1) );
+  for ( u32int st = 1; st <= stations; st++ )
+  {
+    // Nudged by up to a quarter of the spacing either way, so the stations stay in order
+    int nudge = ( spacing >= 4 ) ? (int) ( rs.next() % (spacing / 2 + 1) ) - spacing / 4 : 0;
+    u32int position = (u32int) ( (int) ( st * length / (stations + 1) ) + nudge );
+    u32int stage = ( (st - 1) * (numberOfParts + 1) ) / stations;
+    ItemType *product = ( stage < numberOfParts ) ? parts[stage] : itemP;
+    probability crew = rs.nextProbability();
+    u32int numberOfWorkers = ( crew < 0.15 ) ? 1 : ( crew < 0.85 ) ? 2 : 3;
+    
+    for ( u32int w = 0; w < numberOfWorkers; w++ )
+    {
+      Worker *wk = new Worker();
+      
+      wk->setProduct ( product );
+      wk->setAssemblyTime ( 2 + rs.next() % 7 );
+      wk->setSelective ( w == 0 || rs.nextProbability() < 0.9 );
+      wk->setConsuming ( true );
+      belt->addWorker ( wk, position, 10 + rs.next() % 81 );
+    }
+  }
+  
+  return finishLine ( belt, lineOptions );
+}
+
+// Builds the line from the challenge: components A and B (or nothing) arriving with equal probability, and three
+// pairs of workers assembling P. Each call builds a fresh line, so replicas of an ensemble share no state.
+// With lineOptions->synthetic, it builds a generated factory instead.
+ProductionLine *buildSimpleLine ( LineOptions *lineOptions )
+{
+  if ( lineOptions->synthetic )
+  {
+    return buildSyntheticLine ( lineOptions );
+  }
+  
+  // In this simple sim we have two item types 
+  
+  ItemType *itemA = new ItemType( 'A' ); // Component A
+  ItemType *itemB = new ItemType( 'B' ); // Component B
+  ItemType *itemP = new ItemType( 'P' ); // A finished component, consisting in the simple case of A + B
+
+  // P consists of components A and B.
+  ItemType *componentsNeededForP[] = { itemA, itemB, NULL };
+  itemP->setComponentsRequired ( componentsNeededForP );
+  itemP->setSize ( lineOptions->productSize );
+  
+  ItemType *nullItem = new ItemType( /* NULL item */ );
+  
+  // We have a belt with 5 slots (or longer, with the stations spread along it)
+  u32int length = getLineLength ( lineOptions );
+  Belt *belt = new Belt( length /* 5 slots, space for three pairs of workers, plus an entry and an exit slot */,
+                         lineOptions->compress );
+  
+  // Add item factories to the belt, in the simple sim, giving them all the same weighting makes them equally likely to appear.
+  // so the chance of say 'A' appearing is 50 / 150 ( weighting / total weighting ).
+  u32int *weights = lineOptions->itemWeights, equal[] = { 50, 50, 50 };
+  weights = lineOptions->setWeights ? weights : equal;
+  belt->addItemFactory ( itemA, weights[0] /* Probability weighting (from 0 to 100 (most likely)) */ );
+  belt->addItemFactory ( itemB, weights[1] );
+  belt->addItemFactory ( nullItem, weights[2] );
+
+  DEBUG("Probability of component A appearing = %f\n", itemA->getGenerationProbability());
+  DEBUG("Probability of component B appearing = %f\n", itemB->getGenerationProbability());
+  DEBUG("Probability of no component appearing = %f\n", nullItem->getGenerationProbability());
+  
+  // Add a finished item type to the belt.
+  belt->addFinishedItem ( itemP );
+  
+  // Add our six workers, in pairs of two per slot. We don't care to model here which side of the belt they stand on,
+  // for the simulation in question, it matters not.  The Belt class keeps track of the workers, and will delete them
+  // on our behalf once it is itself destroyed.  We instantiate these workers with default parameters and expecting them to be identical.
+  
+  // Longer lines can have more stations, still a pair of workers at each, spread evenly along the belt.
+  u32int stations = getLineStations ( lineOptions ), crew = ( lineOptions->crew > 0 ) ? lineOptions->crew : 2;
+  for ( u32int st = 1; st <= stations; st++ )
+  {
+    for ( u32int w = 0; w < crew; w++ )
+    {
+      belt->addWorker( new Worker(), st * length / (stations + 1) /* position in the line */);
+    }
+  }
+  
+  return finishLine ( belt, lineOptions );
+}
+
+// Checks the options make sense for the line buildSimpleLine() builds, saying why not if they don't (unless
+// "quiet", for the fuzzer, which tries plenty that don't)
+#define LINE_OPTIONS_ERROR(...) { if ( !quiet ) { printf(__VA_ARGS__); } }
+
+bool checkLineOptions ( LineOptions *lineOptions, bool quiet = false )
+{
+  if ( lineOptions->sinkCapacity > 0 && lineOptions->loop )
+  {
+    LINE_OPTIONS_ERROR("error: an output sink needs a straight belt, not a loop\n");
+    return false;
+  }
+  
+  if ( lineOptions->synthetic && ( lineOptions->syntheticItems == 1 ||
+                                   lineOptions->syntheticItems > strlen ( SYNTHETIC_COMPONENT_NAMES ) ) )
+  {
+    LINE_OPTIONS_ERROR("error: a synthetic factory has 2 to %d types of component\n", (int) strlen ( SYNTHETIC_COMPONENT_NAMES ));
+    return false;
+  }
+  
+  if ( lineOptions->synthetic && ( lineOptions->setWeights || lineOptions->crew > 0 ) )
+  {
+    LINE_OPTIONS_ERROR("error: --weights and --crew are for the challenge's line, a synthetic factory picks its own\n");
+    return false;
+  }
+  if ( lineOptions->setWeights && lineOptions->itemWeights[0] + lineOptions->itemWeights[1] + lineOptions->itemWeights[2] == 0 )
+  {
+    LINE_OPTIONS_ERROR("error: --weights needs something to arrive, even if only gaps\n");
+    return false;
+  }
+  if ( lineOptions->crew > MAX_STATION_CREW )
+  {
+    LINE_OPTIONS_ERROR("error: at most %d workers at a station\n", MAX_STATION_CREW);
+    return false;
+  }
+  
+  u32int length = getLineLength ( lineOptions );
+  u32int stations = getLineStations ( lineOptions );
+  if ( length < stations + 1 )
+  {
+    LINE_OPTIONS_ERROR("error: the belt needs at least %u slots for %u stations\n", stations + 1, stations);
+    return false;
+  }
+  
+  LineOptions plain = *lineOptions;
+  plain.numberOfFeeders = 0;
+  ProductionLine *line = buildSimpleLine ( &plain );
+  bool ok = true;
+  
+  for ( u32int f = 0; f < lineOptions->numberOfFeeders && ok; f++ )
+  {
+    if ( lineOptions->feederSlot[f] >= line->getBelt()->getNumberOfSlots() || lineOptions->feederItems[f][0] == '\0' ||
+         strlen ( lineOptions->feederItems[f] ) > MAX_FEEDER_ITEMS )
+    {
+      LINE_OPTIONS_ERROR("error: feeder %u needs a slot on the belt and 1 to %d items\n", f, MAX_FEEDER_ITEMS);
+      ok = false;
+    }
+    for ( const char *name = lineOptions->feederItems[f]; *name != '\0' && ok; name++ )
+    {
+      if ( findItemFactory ( line->getBelt(), *name ) == NULL )
+      {
+        LINE_OPTIONS_ERROR("error: feeder %u wants item \"%c\", which the line doesn't make\n", f, *name);
+        ok = false;
+      }
+    }
+  }
+  if ( lineOptions->compress && !line->getBelt()->canCompress() )
+  {
+    LINE_OPTIONS_ERROR("error: only a plain straight belt, moving a slot a step, can be compressed\n");
+    ok = false;
+  }
+  if ( lineOptions->productSize > line->getBelt()->getNumberOfSlots() )
+  {
+    LINE_OPTIONS_ERROR("error: a product can't be longer than the belt\n");
+    ok = false;
+  }
+  for ( u32int f = 0; f < lineOptions->numberOfFloaters && ok; f++ )
+  {
+    if ( lineOptions->floaterSlot[f] >= line->getBelt()->getNumberOfSlots() )
+    {
+      LINE_OPTIONS_ERROR("error: floater %u needs a slot on the belt\n", f);
+      ok = false;
+    }
+  }
+  delete line;
+  return ok;
+}
+
+#undef LINE_OPTIONS_ERROR
+
+// ------ Stop conditions: run until the line gets into a given state ------
+//
+// For looking into odd behaviour: run to the first step where, say, every worker has both hands full and can't
+// assemble, or slot 3 has been empty for 20 steps, then print the state there.  A condition is a list of terms,
+// separated by commas, which must all hold at once:
+//
+//   step CMP N            the step number
+//   count:X CMP N         how many X have been collected
+//   slot:S=X, slot:S!=X   what's in slot S, X an item name or "empty"
+//   holding:X CMP N       how many workers hold an X
+//   assembling CMP N      how many workers are assembling
+//   waiting CMP N         how many workers have both hands full but can't assemble
+//
+// where CMP is one of >=, <=, >, <, =, != and N a number, or "all" for every worker.  A term ending "@K" must have
+// held for the last K steps running.  The terms are parsed and resolved against the line once (compile()), to flat
+// records checked in one pass after every step, so a run stops on the first step its condition holds.
+
+#define MAX_STOP_TERMS 8
+
+enum StopTermKind
+{
+  STOP_STEP,
+  STOP_COUNT,
+  STOP_SLOT,
+  STOP_HOLDING,
+  STOP_ASSEMBLING,
+  STOP_WAITING
+};
+
+enum StopCompare
+{
+  STOP_GE, STOP_LE, STOP_GT, STOP_LT, STOP_EQ, STOP_NE
+};
+
+struct StopTerm
+{
+  u8int kind; // A StopTermKind
+  u8int compare; // A StopCompare
+  ascii item; // The item named, if any ('\0' with isEmpty set, for "empty")
+  bool isEmpty;
+  bool all; // Compare with the number of workers, rather than value
+  u32int slot;
+  u64int value;
+  u64int holdFor; // Steps running it must hold for (1 for just this one)
+  ItemType *resolved; // The item, found on the line
+  u64int heldFor; // Steps running it has held for so far
+};
+
+class StopCondition
+{
+private:
+  u32int numberOfTerms;
+  StopTerm terms[MAX_STOP_TERMS];
+  
+  // Reads a comparison off the front of "text", returning what follows it, or NULL if there isn't one
+  static const char *parseCompare ( const char *text, u8int *compare )
+  {
+    static const char *symbols[] = { ">=", "<=", ">", "<", "=", "!=" };
+    static const u8int kinds[] = { STOP_GE, STOP_LE, STOP_GT, STOP_LT, STOP_EQ, STOP_NE };
+    
+    for ( u32int c = 0; c < sizeof(kinds); c++ )
+    {
+      size_t n = strlen ( symbols[c] );
+      if ( strncmp ( text, symbols[c], n ) == 0 )
+      {
+        *compare = kinds[c];
+        return text + n;
+      }
+    }
+    return NULL;
+  }
+  
+  static bool compareValues ( u64int a, u8int compare, u64int b )
+  {
+    switch ( compare )
+    {
+      case STOP_GE: return a >= b;
+      case STOP_LE: return a <= b;
+      case STOP_GT: return a > b;
+      case STOP_LT: return a < b;
+      case STOP_EQ: return a == b;
+      default: return a != b;
+    }
+  }
+  
+  // One term, "text" running up to "end"
+  bool parseTerm ( const char *text, const char *end, StopTerm *t )
+  {
+    static const char *names[] = { "step", "count:", "slot:", "holding:", "assembling", "waiting" };
+    char *after = NULL;
+    
+    memset ( t, 0, sizeof(*t) );
+    t->holdFor = 1;
+    
+    // An "@K" on the end is how long it must hold for
+    const char *at = (const char *) memchr ( text, '@', end - text );
+    if ( at != NULL )
+    {
+      t->holdFor = strtoull ( at + 1, &after, 0 );
+      if ( after != end || t->holdFor == 0 )
+      {
+        return false;
+      }
+      end = at;
+    }
+    
+    u32int k = 0;
+    while ( k < sizeof(names) / sizeof(names[0]) && strncmp ( text, names[k], strlen ( names[k] ) ) != 0 )
+    {
+      k++;
+    }
+    if ( k == sizeof(names) / sizeof(names[0]) )
+    {
+      return false;
+    }
+    t->kind = k;
+    text += strlen ( names[k] );
+    
+    if ( t->kind == STOP_SLOT )
+    {
+      t->slot = strtoul ( text, &after, 0 );
+      if ( after == text )
+      {
+        return false;
+      }
+      text = after;
+    }
+    else if ( t->kind == STOP_COUNT || t->kind == STOP_HOLDING )
+    {
+      if ( text == end )
+      {
+        return false;
+      }
+      t->item = *text++;
+    }
+    
+    text = parseCompare ( text, &t->compare );
+    if ( text == NULL )
+    {
+      return false;
+    }
+    
+    if ( t->kind == STOP_SLOT )
+    {
+      // slot:S=X or slot:S!=X, with X an item or "empty"
+      t->isEmpty = ( (size_t) (end - text) == strlen ( "empty" ) && strncmp ( text, "empty", end - text ) == 0 );
+      t->item = t->isEmpty ? '\0' : *text;
+      return ( t->compare == STOP_EQ || t->compare == STOP_NE ) && ( t->isEmpty || end - text == 1 );
+    }
+    
+    t->all = ( (size_t) (end - text) == strlen ( "all" ) && strncmp ( text, "all", end - text ) == 0 );
+    if ( t->all )
+    {
+      return t->kind == STOP_HOLDING || t->kind == STOP_ASSEMBLING || t->kind == STOP_WAITING;
+    }
+    t->value = strtoull ( text, &after, 0 );
+    return after == end && after != text;
+  }
+  
+  ItemType *findItem ( Belt *belt, ascii name )
+  {
+    for ( u32int list = 0; list < 2; list++ )
+    {
+      for ( ItemType *it = ( list == 0 ) ? belt->getItemFactories() : belt->getFinishedItems(); it != NULL;
+            it = it->nextItemType )
+      {
+        if ( it->getName() == name && !Belt::isEmpty ( it ) )
+        {
+          return it;
+        }
+      }
+    }
+    return NULL;
+  }
+  
+public:
+  
+  StopCondition ()
+  {
+    numberOfTerms = 0;
+  }
+  
+  // Parses the text of a condition, reporting the first term it can't read
+  bool parse ( const char *text )
+  {
+    numberOfTerms = 0;
+    while ( *text != '\0' )
+    {
+      const char *end = strchr ( text, ',' );
+      if ( end == NULL )
+      {
+        end = text + strlen ( text );
+      }
+      
+      if ( numberOfTerms == MAX_STOP_TERMS || !parseTerm ( text, end, &terms[numberOfTerms] ) )
+      {
+        printf("error: can't make sense of the stop condition term \"%.*s\" (or too many terms, max %d)\n",
+               (int) (end - text), text, MAX_STOP_TERMS);
+        return false;
+      }
+      numberOfTerms++;
+      text = ( *end == ',' ) ? end + 1 : end;
+    }
+    return numberOfTerms > 0;
+  }
+  
+  // Resolves the items and slots named against the line, which must then be the one run
+  bool compile ( ProductionLine *line )
+  {
+    Belt *belt = line->getBelt();
+    
+    for ( u32int i = 0; i < numberOfTerms; i++ )
+    {
+      StopTerm *t = &terms[i];
+      
+      t->heldFor = 0;
+      t->resolved = NULL;
+      if ( t->kind == STOP_COUNT || t->kind == STOP_HOLDING || ( t->kind == STOP_SLOT && !t->isEmpty ) )
+      {
+        t->resolved = findItem ( belt, t->item );
+        if ( t->resolved == NULL )
+        {
+          printf("error: no item \"%c\" on the line, for the stop condition\n", t->item);
+          return false;
+        }
+      }
+      if ( t->kind == STOP_SLOT && ( t->slot >= belt->getNumberOfSlots() || belt->isCompressed() ) )
+      {
+        printf("error: the stop condition's slot %u isn't on the belt (or the belt is compressed)\n", t->slot);
+        return false;
+      }
+    }
+    return true;
+  }
+  
+  // Checks the condition against the line as it is now. Call it once a step, as it counts how long each term has
+  // held for.
+  bool isMet ( ProductionLine *line, u64int step )
+  {
+    Belt *belt = line->getBelt();
+    u32int workers = belt->getNumberOfWorkers();
+    bool met = true;
+    
+    for ( u32int i = 0; i < numberOfTerms; i++ )
+    {
+      StopTerm *t = &terms[i];
+      u64int value = 0;
+      bool holds;
+      
+      switch ( t->kind )
+      {
+        case STOP_STEP:
+          value = step;
+          break;
+        case STOP_COUNT:
+          value = t->resolved->getNumberCollected();
+          break;
+        case STOP_SLOT:
+          {
+            ItemType *it = belt->getSlot ( t->slot );
+            value = t->isEmpty ? Belt::isEmpty ( it ) : ( it == t->resolved );
+          }
+          break;
+        default:
+          for ( u32int w = 0; w < workers; w++ )
+          {
+            Worker *wk = belt->getWorker ( w );
+            ItemType *lh = wk->getLeftHand(), *rh = wk->getRightHand();
+            
+            if ( t->kind == STOP_HOLDING )
+            {
+              value += ( lh == t->resolved ) | ( rh == t->resolved );
+            }
+            else if ( t->kind == STOP_ASSEMBLING )
+            {
+              value += ( wk->getAssemblyLeft() > 0 );
+            }
+            else
+            {
+              value += ( lh != NULL && rh != NULL && !wk->isReadyToAct ( belt->getFinishedItems() ) );
+            }
+          }
+          break;
+      }
+      
+      if ( t->kind == STOP_SLOT )
+      {
+        holds = ( value != 0 ) == ( t->compare == STOP_EQ );
+      }
+      else
+      {
+        holds = compareValues ( value, t->compare, t->all ? workers : t->value );
+      }
+      t->heldFor = holds ? t->heldFor + 1 : 0;
+      met = met && ( t->heldFor >= t->holdFor );
+    }
+    return met;
+  }
+  
+  // Steps the line until the condition is met, or for at most "steps" steps. Sets *met to whether it was, and
+  // returns false if the line had to stop early.
+  bool run ( ProductionLine *line, u64int steps, bool *met )
+  {
+    *met = false;
+    for ( u64int i = 0; i < steps && !*met; i++ )
+    {
+      if ( !line->step() )
+      {
+        return false;
+      }
+      *met = isMet ( line, line->getStepNumber() );
+    }
+    return true;
+  }
+};
+
+// ------ Ensembles of replicas ------
+//
+// An ensemble runs the same line many times (replicas), each drawing from its own random stream, derived from the
+// ensemble seed and the replica number, so a replica gives the same answer whichever process or machine runs it.
+// The replicas can be split into shards, each run by an independent process that writes its partial results to a
+// file.  Partial results only hold sufficient statistics (counts, sums, sums of squares, min/max and a log2
+// histogram sketch), all as integers, so any number of shard files can be merged exactly and in any order.
+
+#define MAX_RESULT_ITEMS 64 // Most item types we keep statistics for
+#define HISTOGRAM_BUCKETS 65 // Bucket 0 counts zeroes, bucket b counts values in [2^(b-1), 2^b)
+#define PARTIAL_RESULTS_MAGIC "armChallenge-partial-results"
+#define PARTIAL_RESULTS_VERSION 3
+#define MAX_RESULT_RANGES 256 // Most separate runs of replicas one set of results can hold
+
+// Replicas [first, last) of an ensemble
+struct ReplicaRange
+{
+  u64int first, last;
+};
+
+// What is being counted, for each item type
+enum StatsKind
+{
+  STATS_COLLECTED, // Collected off the end of the belt (or at the output station of a loop)
+  STATS_REJECTED,  // Couldn't get onto the belt, as the entry slot was full
+  STATS_COMPLETION, // Steps taken to reach the item's target count, in replicas run until a target (see RunTargets)
+  NUMBER_OF_STATS_KINDS
+};
+
+static const char *statsKindDescriptions[NUMBER_OF_STATS_KINDS] = { "collected off the belt", "rejected at the entry",
+                                                                     "reached its target" };
+
+// Statistics for the number of one item type collected off the end of the belt, one value per replica
+class ItemStats
+{
+public:
+  ascii name;
+  u8int kind; // A StatsKind
+  u64int replicas; // How many values have been added
+  u64int sum;
+  u128int sumSquares;
+  u64int min, max;
+  u64int histogram[HISTOGRAM_BUCKETS];
+  
+  ItemStats ( ascii n = '\0', u8int k = STATS_COLLECTED )
+  {
+    name = n;
+    kind = k;
+    replicas = 0;
+    sum = 0;
+    sumSquares = 0;
+    min = ~0ULL;
+    max = 0;
+    memset ( histogram, 0, sizeof(histogram) );
+  }
+  
+  static u32int getBucket ( u64int v )
+  {
+    return ( v == 0 ) ? 0 : 64 - __builtin_clzll ( v );
+  }
+  
+  void addValue ( u64int v )
+  {
+    replicas++;
+    sum += v;
+    sumSquares += ((u128int) v) * v;
+    min = ( v < min ) ? v : min;
+    max = ( v > max ) ? v : max;
+    histogram[getBucket ( v )]++;
+  }
+  
+  void merge ( ItemStats *other )
+  {
+    replicas += other->replicas;
+    sum += other->sum;
+    sumSquares += other->sumSquares;
+    min = ( other->min < min ) ? other->min : min;
+    max = ( other->max > max ) ? other->max : max;
+    for ( int b = 0; b < HISTOGRAM_BUCKETS; b++ )
+    {
+      histogram[b] += other->histogram[b];
+    }
+  }
+  
+  double getMean ()
+  {
+    return ( replicas == 0 ) ? 0.0 : ((double) sum) / ((double) replicas);
+  }
+  
+  double getStdDev ()
+  {
+    if ( replicas < 2 )
+    {
+      return 0.0;
+    }
+    // Do the subtraction in integers where we can, n * sum(x^2) - sum(x)^2 is exact and never negative.
+    u128int n = replicas;
+    u128int numerator = n * sumSquares - ((u128int) sum) * sum;
+    return sqrt ( ((double) numerator) / ((double) replicas * (double) (replicas - 1)) );
+  }
+};
+
+class EnsembleResults
+{
+private:
+  u64int steps; // Steps per replica, merging is only meaningful between identical configurations
+  u64int seed;
+  u64int lineHash; // and lines (see getConfigurationHash)
+  u64int replicas;
+  u32int numberOfRanges; // The replicas these results are from, sorted, with neighbouring ranges joined up, so the
+  ReplicaRange ranges[MAX_RESULT_RANGES]; // same shard can't be merged in twice (see coverReplicas)
+  u32int numberOfItems;
+  ItemStats items[MAX_RESULT_ITEMS];
+  
+  ItemStats *findItem ( ascii name, u8int kind )
+  {
+    for ( u32int i = 0; i < numberOfItems; i++ )
+    {
+      if ( items[i].name == name && items[i].kind == kind )
+      {
+        return &items[i];
+      }
+    }
+    
+    if ( numberOfItems == MAX_RESULT_ITEMS )
+    {
+      printf("error: too many item types for ensemble statistics (max %d)\n", MAX_RESULT_ITEMS);
+      return NULL;
+    }
+    
+    items[numberOfItems] = ItemStats ( name, kind );
+    return &items[numberOfItems++];
+  }
+  
+  void addItemList ( ItemType *it, u8int kind )
+  {
+    while ( it != NULL )
+    {
+      // Nothing is lost when an empty item is turned away
+      ItemStats *is = ( kind == STATS_REJECTED && Belt::isEmpty ( it ) ) ? NULL : findItem ( it->getName(), kind );
+      if ( is != NULL )
+      {
+        is->addValue ( ( kind == STATS_REJECTED ) ? it->getNumberRejected() : it->getNumberCollected() );
+      }
+      it = it->nextItemType;
+    }
+  }
+  
+public:
+  
+  EnsembleResults ( u64int stps = 0, u64int sd = 0, u64int lh = 0 )
+  {
+    steps = stps;
+    seed = sd;
+    lineHash = lh;
+    replicas = 0;
+    numberOfRanges = 0;
+    numberOfItems = 0;
+  }
+  
+  u64int getReplicas ()
+  {
+    return replicas;
+  }
+  
+  // Record the counts from a line which has finished running, and for a run until a target, how long the target
+  // it reached took (the replicas which reach none are the ones missing from the completion statistics).
+  void addReplica ( ProductionLine *line, RunTargets *targets = NULL )
+  {
+    addItemList ( line->getBelt()->getItemFactories(), STATS_COLLECTED );
+    addItemList ( line->getBelt()->getFinishedItems(), STATS_COLLECTED );
+    
+    int reached = line->getReachedTarget ( targets );
+    if ( reached >= 0 )
+    {
+      addItemValue ( targets->name[reached], line->getStepNumber(), STATS_COMPLETION );
+    }
+    
+    // Only a loop, a belt which slips when blocked, or a side feeder finding its slot full can turn items away
+    if ( line->getBelt()->canReject() )
+    {
+      addItemList ( line->getBelt()->getItemFactories(), STATS_REJECTED );
+    }
+    replicas++;
+  }
+  
+  // The most statistics a replica of the line adds (see addReplica), which need to fit in MAX_RESULT_ITEMS
+  static u32int countItemsNeeded ( Belt *belt, RunTargets *targets )
+  {
+    u32int n = targets->number;
+    
+    for ( ItemType *it = belt->getItemFactories(); it != NULL; it = it->nextItemType )
+    {
+      n += ( belt->canReject() && !Belt::isEmpty ( it ) ) ? 2 : 1;
+    }
+    for ( ItemType *it = belt->getFinishedItems(); it != NULL; it = it->nextItemType )
+    {
+      n++;
+    }
+    return n;
+  }
+  
+  // Or, for engines which don't keep their counts in ItemTypes, one value per item (in list order) and then
+  // count the replica.
+  void addItemValue ( ascii name, u64int value, u8int kind = STATS_COLLECTED )
+  {
+    ItemStats *is = findItem ( name, kind );
+    if ( is != NULL )
+    {
+      is->addValue ( value );
+    }
+  }
+  
+  void countReplica ()
+  {
+    replicas++;
+  }
+  
+  // Notes that the replicas [first, last) are in these results, once they have been run (the threads of one process
+  // leave this to whoever runs them, as they take their replicas from a shared queue). Returns false if some of
+  // them are here already, or there are too many separate ranges.
+  bool coverReplicas ( u64int first, u64int last )
+  {
+    u32int r = 0;
+    
+    if ( first == last )
+    {
+      return true;
+    }
+    while ( r < numberOfRanges && ranges[r].last <= first )
+    {
+      r++;
+    }
+    if ( r < numberOfRanges && ranges[r].first < last )
+    {
+      u64int from = ( ranges[r].first > first ) ? ranges[r].first : first;
+      u64int to = ( ranges[r].last < last ) ? ranges[r].last : last;
+      printf("error: replicas %llu to %llu are in the results more than once\n", (unsigned long long) from,
+             (unsigned long long) ( to - 1 ));
+      return false;
+    }
+    
+    // Range r is the first after [first, last), join up with it and the one before where they meet
+    bool joinBefore = ( r > 0 && ranges[r - 1].last == first );
+    bool joinAfter = ( r < numberOfRanges && ranges[r].first == last );
+    if ( joinBefore && joinAfter )
+    {
+      ranges[r - 1].last = ranges[r].last;
+      memmove ( &ranges[r], &ranges[r + 1], ( numberOfRanges - r - 1 ) * sizeof(ReplicaRange) );
+      numberOfRanges--;
+    }
+    else if ( joinBefore )
+    {
+      ranges[r - 1].last = last;
+    }
+    else if ( joinAfter )
+    {
+      ranges[r].first = first;
+    }
+    else
+    {
+      if ( numberOfRanges == MAX_RESULT_RANGES )
+      {
+        printf("error: the results would hold more than %d separate ranges of replicas, merge neighbouring shards "
+               "first\n", MAX_RESULT_RANGES);
+        return false;
+      }
+      memmove ( &ranges[r + 1], &ranges[r], ( numberOfRanges - r ) * sizeof(ReplicaRange) );
+      ranges[r].first = first;
+      ranges[r].last = last;
+      numberOfRanges++;
+    }
+    return true;
+  }
+  
+  bool merge ( EnsembleResults *other )
+  {
+    if ( other->replicas == 0 )
+    {
+      return true; // Nothing to do, and an empty result is compatible with anything
+    }
+    if ( replicas == 0 )
+    {
+      steps = other->steps;
+      seed = other->seed;
+      lineHash = other->lineHash;
+    }
+    else if ( steps != other->steps || seed != other->seed )
+    {
+      printf("error: cannot merge results from different configurations (steps %llu/%llu, seed %llu/%llu)\n",
+             (unsigned long long) steps, (unsigned long long) other->steps,
+             (unsigned long long) seed, (unsigned long long) other->seed);
+      return false;
+    }
+    else if ( lineHash != other->lineHash )
+    {
+      printf("error: cannot merge results from different lines (line hash %016llx/%016llx)\n",
+             (unsigned long long) lineHash, (unsigned long long) other->lineHash);
+      return false;
+    }
+    
+    // Check every range before taking any, so a failed merge leaves these results as they were
+    for ( u32int o = 0; o < other->numberOfRanges; o++ )
+    {
+      for ( u32int r = 0; r < numberOfRanges; r++ )
+      {
+        if ( other->ranges[o].first < ranges[r].last && ranges[r].first < other->ranges[o].last )
+        {
+          return coverReplicas ( other->ranges[o].first, other->ranges[o].last ); // Which says where they overlap
+        }
+      }
+    }
+    for ( u32int o = 0; o < other->numberOfRanges; o++ )
+    {
+      if ( !coverReplicas ( other->ranges[o].first, other->ranges[o].last ) )
+      {
+        return false;
+      }
+    }
+    
+    for ( u32int i = 0; i < other->numberOfItems; i++ )
+    {
+      ItemStats *is = findItem ( other->items[i].name, other->items[i].kind );
+      if ( is == NULL )
+      {
+        return false;
+      }
+      is->merge ( &other->items[i] );
+    }
+    replicas += other->replicas;
+    return true;
+  }
+  
+  // File format is line based text, so partial results can be inspected and moved between machines:
+  //   armChallenge-partial-results <version>
+  //   steps <n>
+  //   seed <n>
+  //   line <hash of the line's options, in hex>
+  //   replicas <n>
+  //   ranges <number of ranges> <first> <last> ... (the replicas [first, last) held, in order)
+  //   item <name as ascii code> <kind> <replicas> <sum> <sum of squares, high 64 bits> <low 64 bits> <min> <max>
+  //   hist <name as ascii code> <kind> <bucket 0> ... <bucket 64>
+  //   end
+  bool write ( const char *fileName )
+  {
+    FILE *f = fopen ( fileName, "w" );
+    if ( f == NULL )
+    {
+      printf("error: could not open \"%s\" for writing\n", fileName);
+      return false;
+    }
+    
+    fprintf(f, "%s %d\n", PARTIAL_RESULTS_MAGIC, PARTIAL_RESULTS_VERSION);
+    fprintf(f, "steps %llu\nseed %llu\nline %016llx\nreplicas %llu\n", (unsigned long long) steps,
+            (unsigned long long) seed, (unsigned long long) lineHash, (unsigned long long) replicas);
+    fprintf(f, "ranges %u", numberOfRanges);
+    for ( u32int r = 0; r < numberOfRanges; r++ )
+    {
+      fprintf(f, " %llu %llu", (unsigned long long) ranges[r].first, (unsigned long long) ranges[r].last);
+    }
+    fprintf(f, "\n");
+    for ( u32int i = 0; i < numberOfItems; i++ )
+    {
+      ItemStats *is = &items[i];
+      fprintf(f, "item %u %u %llu %llu %llu %llu %llu %llu\n", is->name, is->kind, (unsigned long long) is->replicas,
+              (unsigned long long) is->sum, (unsigned long long) (is->sumSquares >> 64),
+              (unsigned long long) is->sumSquares, (unsigned long long) is->min, (unsigned long long) is->max);
+      fprintf(f, "hist %u %u", is->name, is->kind);
+      for ( int b = 0; b < HISTOGRAM_BUCKETS; b++ )
+      {
+        fprintf(f, " %llu", (unsigned long long) is->histogram[b]);
+      }
+      fprintf(f, "\n");
+    }
+    fprintf(f, "end\n");
+    
+    // Check the close as well, a full shared filesystem shows up here.
+    if ( ferror ( f ) != 0 || fclose ( f ) != 0 )
+    {
+      printf("error: failed writing \"%s\"\n", fileName);
+      return false;
+    }
+    return true;
+  }
+  
+  bool read ( const char *fileName )
+  {
+    FILE *f = fopen ( fileName, "r" );
+    if ( f == NULL )
+    {
+      printf("error: could not open \"%s\" for reading\n", fileName);
+      return false;
+    }
+    
+    char magic[64];
+    int version = 0;
+    unsigned long long st = 0, sd = 0, lh = 0, rp = 0; // Left as nothing, when the header can't be read
+    unsigned int nr = 0;
+    bool ok = ( fscanf(f, "%63s %d", magic, &version) == 2 && strcmp(magic, PARTIAL_RESULTS_MAGIC) == 0 &&
+                version == PARTIAL_RESULTS_VERSION &&
+                fscanf(f, " steps %llu seed %llu line %llx replicas %llu ranges %u", &st, &sd, &lh, &rp, &nr) == 5 &&
+                nr <= MAX_RESULT_RANGES );
+    
+    steps = st;
+    seed = sd;
+    lineHash = lh;
+    replicas = rp;
+    numberOfRanges = 0;
+    numberOfItems = 0;
+    
+    // The ranges are in order and apart, and hold exactly the replicas counted
+    u64int covered = 0;
+    for ( u32int r = 0; ok && r < nr; r++ )
+    {
+      unsigned long long first = 0, last = 0;
+      ok = ( fscanf(f, "%llu %llu", &first, &last) == 2 && first < last &&
+             ( r == 0 || first > ranges[r - 1].last ) );
+      ranges[r].first = first;
+      ranges[r].last = last;
+      numberOfRanges++;
+      covered += last - first;
+    }
+    ok = ok && ( covered == replicas );
+    
+    char tag[16];
+    while ( ok && fscanf(f, "%15s", tag) == 1 && strcmp(tag, "end") != 0 )
+    {
+      unsigned int name, kind, histName, histKind;
+      unsigned long long n, sum, sqHi, sqLo, mn, mx;
+      
+      ok = ( strcmp(tag, "item") == 0 &&
+             fscanf(f, "%u %u %llu %llu %llu %llu %llu %llu", &name, &kind, &n, &sum, &sqHi, &sqLo, &mn, &mx) == 8 &&
+             kind < NUMBER_OF_STATS_KINDS &&
+             fscanf(f, " hist %u %u", &histName, &histKind) == 2 && histName == name && histKind == kind );
+      
+      // Each item and kind only once, findItem() would add a second into the first
+      u32int before = numberOfItems;
+      ItemStats *is = ok ? findItem ( (ascii) name, kind ) : NULL;
+      ok = ( is != NULL && numberOfItems > before );
+      if ( ok )
+      {
+        is->replicas = n;
+        is->sum = sum;
+        is->sumSquares = (((u128int) sqHi) << 64) | sqLo;
+        is->min = mn;
+        is->max = mx;
+        for ( int b = 0; ok && b < HISTOGRAM_BUCKETS; b++ )
+        {
+          unsigned long long count;
+          ok = ( fscanf(f, "%llu", &count) == 1 );
+          is->histogram[b] = count;
+        }
+      }
+    }
+    ok = ok && ( strcmp(tag, "end") == 0 ); // A truncated file (say, a shard that died mid-write) has no end marker
+    fclose ( f );
+    
+    if ( !ok )
+    {
+      printf("error: \"%s\" is not a valid partial results file\n", fileName);
+    }
+    return ok;
+  }
+  
+  // A hash of everything we hold (FNV-1a, items taken in name and kind order), so two runs can be checked for identical
+  // results, whatever the number of threads, shards or order of merging.
+  u64int getDigest ()
+  {
+    u64int h = 0xcbf29ce484222325ULL;
+    u64int header[] = { steps, seed, replicas };
+    
+    h = hashWords ( h, header, 3 );
+    for ( u32int key = 0; key < 256 * NUMBER_OF_STATS_KINDS; key++ )
+    {
+      for ( u32int i = 0; i < numberOfItems; i++ )
+      {
+        ItemStats *is = &items[i];
+        if ( is->name == key / NUMBER_OF_STATS_KINDS && is->kind == key % NUMBER_OF_STATS_KINDS )
+        {
+          u64int fields[] = { is->name, is->kind, is->replicas, is->sum, (u64int) (is->sumSquares >> 64),
+                              (u64int) is->sumSquares, is->min, is->max };
+          h = hashWords ( h, fields, 8 );
+          h = hashWords ( h, is->histogram, HISTOGRAM_BUCKETS );
+        }
+      }
+    }
+    return h;
+  }
+  
+  static u64int hashWords ( u64int h, u64int *words, u32int n )
+  {
+    for ( u32int w = 0; w < n; w++ )
+    {
+      for ( int byte = 0; byte < 8; byte++ )
+      {
+        h = ( h ^ ((words[w] >> (byte * 8)) & 0xff) ) * 0x100000001b3ULL;
+      }
+    }
+    return h;
+  }
+  
+  // The distribution of the steps taken to reach a target, with its histogram sketch as a rough shape
+  void printCompletion ( ItemStats *is )
+  {
+    printf("Item \"%c\", %s in %llu of %llu replicas, after %.3f steps (sd %.3f, min %llu, max %llu)\n",
+           is->name, statsKindDescriptions[is->kind], (unsigned long long) is->replicas, (unsigned long long) replicas,
+           is->getMean(), is->getStdDev(), (unsigned long long) is->min, (unsigned long long) is->max);
+    for ( int b = 0; b < HISTOGRAM_BUCKETS; b++ )
+    {
+      if ( is->histogram[b] > 0 )
+      {
+        u64int lo = ( b == 0 ) ? 0 : 1ULL << (b - 1), hi = ( b == 0 ) ? 0 : ( b == 64 ) ? ~0ULL : (1ULL << b) - 1;
+        printf("  %llu to %llu steps: %llu replicas (%.1f%%)\n", (unsigned long long) lo, (unsigned long long) hi,
+               (unsigned long long) is->histogram[b], 100.0 * (double) is->histogram[b] / (double) replicas);
+      }
+    }
+  }
+  
+  void print ()
+  {
+    printf("Ensemble of %llu replicas, %llu steps each (seed %llu)\n", (unsigned long long) replicas,
+           (unsigned long long) steps, (unsigned long long) seed);
+    for ( u32int i = 0; i < numberOfItems; i++ )
+    {
+      ItemStats *is = &items[i];
+      if ( is->kind == STATS_COMPLETION )
+      {
+        printCompletion ( is );
+        continue;
+      }
+      printf("Item \"%c\", %s %.3f times per replica (sd %.3f, min %llu, max %llu)\n",
+             is->name, statsKindDescriptions[is->kind], is->getMean(), is->getStdDev(), (unsigned long long) is->min, (unsigned long long) is->max);
+    }
+    printf("Results digest %016llx\n", (unsigned long long) getDigest());
+  }
+};
+
+struct EnsembleOptions
+{
+  u64int replicas;
+  u64int steps;
+  u64int seed;
+  u32int shards; // Split the replicas into this many shards
+  int shardIndex; // Run only this shard in this process (-1 runs them all, in one process per shard)
+  const char *outName; // Partial results file (or file name prefix, when forking one process per shard)
+  u32int threads; // Threads per process
+  bool pinThreads; // Pin each thread to its own core, so its line state stays on that core's NUMA node
+  u32int interleave; // Replicas each thread steps in turn, to overlap their cache misses
+  u32int lanes; // If set, run replicas this many at a time in the lane engine
+  LineOptions line;
+  u64int flushEvery; // For a single long run, print the counts so far every this many steps (0 for never)
+  bool stationLanes; // Run each line in the station engine, with its stations worked lane-wise
+  RunTargets targets; // Stop each replica once it reaches one of these (steps is then the most it runs for)
+  const char *stopWhen; // For a single run, a StopCondition to run until
+};
+
+// Replicas [first, last) of shard "shard" in an ensemble split "shards" ways
+void getShardRange ( u64int replicas, u32int shards, u32int shard, u64int *first, u64int *last )
+{
+  *first = ( replicas * shard ) / shards;
+  *last = ( replicas * (shard + 1) ) / shards;
+}
+
+// A hash (FNV-1a) of the line the options give and the targets its replicas run to, everything bar the steps and
+// seed that the results depend on, so partial results from different lines can't be merged
+u64int getConfigurationHash ( EnsembleOptions *opts )
+{
+  char args[2048];
+  u64int h = 0xcbf29ce484222325ULL;
+  
+  formatLineOptions ( &opts->line, args, sizeof(args) );
+  for ( const char *c = args; *c != '\0'; c++ )
+  {
+    h = ( h ^ (u8int) *c ) * 0x100000001b3ULL;
+  }
+  for ( u32int t = 0; t < opts->targets.number; t++ )
+  {
+    u64int target[] = { opts->targets.name[t], opts->targets.count[t] };
+    h = EnsembleResults::hashWords ( h, target, 2 );
+  }
+  return h;
+}
+
+#define MAX_INTERLEAVE 64
+
+// Runs replicas [first, last) in the lane engine, opts->lanes at a time. All the replicas share the one
+// configuration, so the line is only built once, to set the engine up.
+void runLaneReplicas ( u64int first, u64int last, EnsembleOptions *opts, EnsembleResults *results )
+{
+  u32int group = ( opts->lanes > ENGINE_LANES ) ? ENGINE_LANES : opts->lanes;
+  RandomStream streams[ENGINE_LANES];
+  ProductionLine *line = buildSimpleLine( &opts->line );
+  
+  if ( !LaneEngine::canRun ( line->getBelt() ) )
+  {
+    printf("error: this line doesn't fit the lane engine\n");
+    delete line;
+    return;
+  }
+  LaneEngine *engine = new LaneEngine ( line->getBelt() );
+  
+  for ( u64int r = first; r < last; r += group )
+  {
+    u32int n = ( last - r < group ) ? (u32int) (last - r) : group;
+    
+    for ( u32int l = 0; l < n; l++ )
+    {
+      streams[l].setSeed ( opts->seed, r + l );
+    }
+    setAllocationPhase ( ALLOC_RUN );
+    engine->run ( n, opts->steps, streams );
+    setAllocationPhase ( ALLOC_REPORT );
+    
+    for ( u32int l = 0; l < n; l++ )
+    {
+      for ( u32int i = 0; i < engine->getNumberReported(); i++ )
+      {
+        results->addItemValue ( engine->getReportedItem ( i )->getName(), engine->getReportedCount ( i, l ) );
+      }
+      results->countReplica();
+    }
+  }
+  
+  delete engine;
+  delete line;
+}
+
+// Runs replicas [first, last) in the station engine, one at a time, each with its own stream
+void runStationReplicas ( u64int first, u64int last, EnsembleOptions *opts, EnsembleResults *results )
+{
+  ProductionLine *line = buildSimpleLine( &opts->line );
+  RandomStream stream;
+  
+  if ( !StationEngine::canRun ( line->getBelt() ) )
+  {
+    printf("error: this line doesn't fit the station engine\n");
+    delete line;
+    return;
+  }
+  
+  for ( u64int r = first; r < last; r++ )
+  {
+    setAllocationPhase ( ALLOC_SETUP );
+    StationEngine *engine = new StationEngine ( line->getBelt() );
+    
+    stream.setSeed ( opts->seed, r );
+    setRandomStream ( &stream );
+    setAllocationPhase ( ALLOC_RUN );
+    engine->run ( opts->steps );
+    setAllocationPhase ( ALLOC_REPORT );
+    for ( u32int i = 0; i < engine->getNumberReported(); i++ )
+    {
+      results->addItemValue ( engine->getReportedItem ( i )->getName(), engine->getReportedCount ( i ) );
+    }
+    results->countReplica();
+    delete engine;
+  }
+  setRandomStream ( NULL );
+  delete line;
+}
+
+// Whether the ensemble opts asks for can run its line, saying why not if it can't: the engine has to take the line
+// (the ordinary engine always can), and its statistics have to fit in the results.  The runners check the engine
+// again, and the results their room, but by then all they can do is drop the replicas, so check before starting.
+bool checkEnsembleOptions ( EnsembleOptions *opts )
+{
+  bool engine = ( opts->lanes > 0 || opts->stationLanes );
+  const char *engineName = ( opts->lanes > 0 ) ? "lane" : "station";
+  
+  // As finishLine() sets it, a generated factory always gives every worker a turn
+  if ( engine && !opts->line.everyWorker && !opts->line.synthetic )
+  {
+    printf("error: the %s engine gives every worker a turn each step, it needs --every-worker\n", engineName);
+    return false;
+  }
+  if ( opts->replicas == 0 )
+  {
+    return true; // A single run checks its line fits the engine when it builds it (see main)
+  }
+  
+  ProductionLine *line = buildSimpleLine( &opts->line );
+  u32int needed = EnsembleResults::countItemsNeeded ( line->getBelt(), &opts->targets );
+  bool ok = !engine || ( ( opts->lanes > 0 ) ? LaneEngine::canRun ( line->getBelt() ) :
+                                               StationEngine::canRun ( line->getBelt() ) );
+  
+  delete line;
+  if ( needed > MAX_RESULT_ITEMS )
+  {
+    printf("error: the line needs statistics for %u item types, more than an ensemble keeps (%d)\n", needed,
+           MAX_RESULT_ITEMS);
+    return false;
+  }
+  if ( !ok )
+  {
+    printf("error: this line doesn't fit the %s engine\n", engineName);
+  }
+  return ok;
+}
+
+// Runs replicas [first, last) of the simple line, adding their counts to the results.
+// With opts->interleave > 1, the replicas are run in groups, stepping each replica of a group in turn and
+// prefetching the next one's state before stepping the current one. On lines too big for the cache, that overlaps
+// one replica's misses with the others' work. The results are identical either way, as each replica still draws
+// from its own stream in the same order.
+// With opts->lanes set, they are handed to the lane engine instead, and with opts->stationLanes, the station engine.
+void runReplicas ( u64int first, u64int last, EnsembleOptions *opts, EnsembleResults *results )
+{
+  if ( opts->lanes > 0 )
+  {
+    runLaneReplicas ( first, last, opts, results );
+    return;
+  }
+  if ( opts->stationLanes )
+  {
+    runStationReplicas ( first, last, opts, results );
+    return;
+  }
+  
+  u32int group = ( opts->interleave < 1 ) ? 1 : ( opts->interleave > MAX_INTERLEAVE ) ? MAX_INTERLEAVE : opts->interleave;
+  RandomStream streams[MAX_INTERLEAVE];
+  ProductionLine *lines[MAX_INTERLEAVE];
+  
+  for ( u64int r = first; r < last; r += group )
+  {
+    u32int n = ( last - r < group ) ? (u32int) (last - r) : group;
+    
+    // Each replica gets its own stream, so the results don't depend on how the replicas are split up.
+    setAllocationPhase ( ALLOC_SETUP );
+    for ( u32int b = 0; b < n; b++ )
+    {
+      streams[b].setSeed ( opts->seed, r + b );
+      setRandomStream ( &streams[b] ); // Building a line may draw random numbers in future
+      lines[b] = buildSimpleLine( &opts->line );
+    }
+    
+    if ( n == 1 )
+    {
+      lines[0]->runSim ( opts->steps, &opts->targets );
+    }
+    else
+    {
+      // Replicas which reach a target drop out of the group, and the others carry on without them
+      bool running = true;
+      bool finished[MAX_INTERLEAVE];
+      u32int left = n;
+      
+      memset ( finished, 0, sizeof(finished) );
+      for ( u64int i = 0; running && left > 0 && i < opts->steps; i++ )
+      {
+        for ( u32int b = 0; b < n; b++ )
+        {
+          if ( finished[b] )
+          {
+            continue;
+          }
+          lines[(b + 1) % n]->prefetch();
+          setRandomStream ( &streams[b] );
+          running = lines[b]->step() && running;
+          if ( opts->targets.number > 0 && lines[b]->getReachedTarget ( &opts->targets ) >= 0 )
+          {
+            finished[b] = true;
+            left--;
+          }
+        }
+      }
+    }
+    
+    setAllocationPhase ( ALLOC_REPORT );
+    for ( u32int b = 0; b < n; b++ )
+    {
+      results->addReplica ( lines[b], &opts->targets );
+      delete lines[b];
+    }
+    setRandomStream ( NULL );
+  }
+}
+
+// Pins the calling thread to the n'th core this process is allowed to run on (wrapping round if there are more
+// threads than cores).  Pinning before the thread builds its lines keeps their memory on the local NUMA node, as
+// the kernel places pages on the node of the core that first touches them.
+bool pinThreadToCore ( u32int n )
+{
+#if defined (__linux__)
+  cpu_set_t allowed, mine;
+  
+  if ( sched_getaffinity ( 0, sizeof(allowed), &allowed ) != 0 || CPU_COUNT ( &allowed ) == 0 )
+  {
+    return false;
+  }
+  
+  u32int wanted = n % CPU_COUNT ( &allowed );
+  for ( int cpu = 0; cpu < CPU_SETSIZE; cpu++ )
+  {
+    if ( CPU_ISSET ( cpu, &allowed ) && wanted-- == 0 )
+    {
+      CPU_ZERO ( &mine );
+      CPU_SET ( cpu, &mine );
+      return pthread_setaffinity_np ( pthread_self(), sizeof(mine), &mine ) == 0;
+    }
+  }
+#endif
+  (void) n;
+  return false; // GK: No affinity API on macOS, threads are left to the scheduler
+}
+
+// Threads take replicas from a shared queue a block at a time, so a slow thread doesn't hold everyone up.
+// Which thread runs which block varies from run to run, but can't change the answer: every replica has its own
+// stream, and the statistics are integers, whose sums come out the same in any order.
+#define REPLICA_BLOCK 64 // A whole lane engine group
+
+struct ReplicaQueue
+{
+  u64int first, last;
+  u64int nextBlock; // Taken with an atomic add, there's no lock
+};
+
+struct ReplicaThread
+{
+  pthread_t thread;
+  u32int index;
+  ReplicaQueue *queue;
+  EnsembleOptions *opts;
+  EnsembleResults *results; // Owned by the thread (and allocated by it, so it's local too)
+};
+
+void *runReplicaThread ( void *arg )
+{
+  ReplicaThread *rt = (ReplicaThread *) arg;
+  
+  if ( rt->opts->pinThreads && !pinThreadToCore ( rt->index ) )
+  {
+    printf("warning: could not pin thread %u\n", rt->index);
+  }
+  
+  rt->results = new EnsembleResults ( rt->opts->steps, rt->opts->seed, getConfigurationHash ( rt->opts ) );
+  
+  for ( ;; )
+  {
+    u64int block = __atomic_fetch_add ( &rt->queue->nextBlock, 1, __ATOMIC_RELAXED );
+    u64int first = rt->queue->first + block * REPLICA_BLOCK;
+    
+    if ( first >= rt->queue->last )
+    {
+      break;
+    }
+    u64int last = ( rt->queue->last - first < REPLICA_BLOCK ) ? rt->queue->last : first + REPLICA_BLOCK;
+    runReplicas ( first, last, rt->opts, rt->results );
+  }
+  return NULL;
+}
+
+// Runs replicas [first, last) across opts->threads threads, each building and running its own lines.
+// The per-thread results are then combined pairwise, in a fixed tree over the thread numbers, so no one thread
+// merges everything, and the answer is bit-identical for any number of threads.
+void runReplicasOnThreads ( u64int first, u64int last, EnsembleOptions *opts, EnsembleResults *results )
+{
+  if ( opts->threads <= 1 && !opts->pinThreads )
+  {
+    runReplicas ( first, last, opts, results );
+    return;
+  }
+  
+  u32int threads = ( opts->threads == 0 ) ? 1 : opts->threads;
+  ReplicaThread *rts = (ReplicaThread *) calloc ( threads, sizeof(ReplicaThread) );
+  ReplicaQueue queue = { first, last, 0 };
+  
+  for ( u32int t = 0; t < threads; t++ )
+  {
+    rts[t].index = t;
+    rts[t].queue = &queue;
+    rts[t].opts = opts;
+    
+    if ( pthread_create ( &rts[t].thread, NULL, runReplicaThread, &rts[t] ) != 0 )
+    {
+      // Can't have another thread, so help empty the queue ourselves
+      runReplicaThread ( &rts[t] );
+      rts[t].thread = pthread_self();
+    }
+  }
+  
+  for ( u32int t = 0; t < threads; t++ )
+  {
+    if ( !pthread_equal ( rts[t].thread, pthread_self() ) )
+    {
+      pthread_join ( rts[t].thread, NULL );
+    }
+  }
+  
+  for ( u32int stride = 1; stride < threads; stride *= 2 )
+  {
+    for ( u32int t = 0; t + stride < threads; t += 2 * stride )
+    {
+      rts[t].results->merge ( rts[t + stride].results );
+    }
+  }
+  results->merge ( rts[0].results );
+  
+  for ( u32int t = 0; t < threads; t++ )
+  {
+    delete rts[t].results;
+  }
+  free ( rts );
+}
+
+// Forks one process per shard, each writing "<outName>.<shard>", then merges whichever shards succeeded.
+// A crash in one shard only loses that shard, which can be rerun on its own with --shard.
+int runShardedEnsemble ( EnsembleOptions *opts )
+{
+  pid_t *pids = (pid_t *) malloc ( opts->shards * sizeof(pid_t) );
+  char fileName[1024];
+  
+  fflush ( stdout ); // Don't let the children inherit (and print again) anything still buffered
+  
+  for ( u32int s = 0; s < opts->shards; s++ )
+  {
+    pids[s] = fork();
+    if ( pids[s] == 0 )
+    {
+      u64int first, last;
+      getShardRange ( opts->replicas, opts->shards, s, &first, &last );
+      
+      EnsembleResults results ( opts->steps, opts->seed, getConfigurationHash ( opts ) );
+      runReplicasOnThreads ( first, last, opts, &results );
+      results.coverReplicas ( first, last );
+      
+      snprintf ( fileName, sizeof(fileName), "%s.%u", opts->outName, s );
+      fflush ( stdout );
+      _exit ( ( results.write ( fileName ) && checkAllocations() ) ? 0 : 1 );
+    }
+    if ( pids[s] < 0 )
+    {
+      printf("error: could not fork shard %u\n", s);
+    }
+  }
+  
+  // Wait for everyone, then merge the shards that finished properly
+  EnsembleResults merged ( opts->steps, opts->seed, getConfigurationHash ( opts ) );
+  int failed = 0;
+  
+  for ( u32int s = 0; s < opts->shards; s++ )
+  {
+    int status = 0;
+    bool ok = ( pids[s] > 0 && waitpid ( pids[s], &status, 0 ) == pids[s] && WIFEXITED(status) &&
+                WEXITSTATUS(status) == 0 );
+    
+    if ( ok )
+    {
+      EnsembleResults partial;
+      snprintf ( fileName, sizeof(fileName), "%s.%u", opts->outName, s );
+      ok = partial.read ( fileName ) && merged.merge ( &partial );
+    }
+    if ( !ok )
+    {
+      printf("error: shard %u/%u failed, rerun it with --shard %u/%u\n", s, opts->shards, s, opts->shards);
+      failed++;
+    }
+  }
+  free ( pids );
+  
+  merged.print();
+  return failed;
+}
+
+// Merges partial result files, writing the combined result (which can itself be merged again later)
+int mergePartialResults ( const char *outName, int numberOfInputs, char **inputNames )
+{
+  EnsembleResults merged;
+  struct stat out, in;
+  bool outExists = ( stat ( outName, &out ) == 0 );
+  
+  if ( numberOfInputs < 1 )
+  {
+    printf("error: --merge needs at least one partial results file to merge into \"%s\"\n", outName);
+    return 1;
+  }
+  
+  // Writing over an input would lose it, if the merge went wrong
+  for ( int i = 0; i < numberOfInputs; i++ )
+  {
+    if ( strcmp ( inputNames[i], outName ) == 0 ||
+         ( outExists && stat ( inputNames[i], &in ) == 0 && in.st_dev == out.st_dev && in.st_ino == out.st_ino ) )
+    {
+      printf("error: \"%s\" is one of the files being merged, it can't be where they go too\n", outName);
+      return 1;
+    }
+  }
+  
+  for ( int i = 0; i < numberOfInputs; i++ )
+  {
+    EnsembleResults partial;
+    if ( !partial.read ( inputNames[i] ) || !merged.merge ( &partial ) )
+    {
+      return 1;
+    }
+  }
+  
+  merged.print();
+  return merged.write ( outName ) ? 0 : 1;
+}
+
+// The benchmark scenarios, each an ensemble run single threaded, timed in ns per replica step. Other options on the
+// command line apply to all of them (those a scenario can't take make it fail, and it is left out).  The "line"
+// scenario is the command line's own line, just as given, run once for --steps, and is only run when asked for by
+// name (with --bench-only line), to time a line found by --fuzz, say.
+// GK: Keep their names and sizes fixed, or stored baselines stop matching up. Add new ones, rather than change these.
+struct BenchScenario
+{
+  const char *name;
+  u64int replicas, steps;
+  u32int interleave, lanes;
+  bool stationLanes;
+  u32int beltLength, numberOfStations;
+  bool compress;
+  bool synthetic; // The generated factory of seed 1, of the default size
+  bool everyWorker; // Every worker's turn each step (as all of them were timed with, before it was an option)
+  bool ownLine; // The line on the command line, as it is, rather than the fields above
+};
+
+static BenchScenario benchScenarios[] =
+{
+  { "challenge",     400,  1000, 1, 0,  false, 0,     0,    false, false, true,  false }, // The 5 slot line from the challenge
+  { "interleaved",   400,  1000, 8, 0,  false, 0,     0,    false, false, true,  false },
+  { "lanes",         1024, 1000, 1, 64, false, 0,     0,    false, false, true,  false },
+  { "long-line",     2,    2000, 1, 0,  false, 4000,  1000, false, false, true,  false },
+  { "station-lanes", 2,    2000, 1, 0,  true,  4000,  1000, false, false, true,  false },
+  { "compressed",    4,    20000, 1, 0, false, 20000, 50,   true,  false, true,  false },
+  { "synthetic",     2,    2000, 1, 0,  false, 0,     0,    false, true,  true,  false },
+  { "line",          1,    0,    1, 0,  false, 0,     0,    false, false, false, true  }, // --steps of the given line
+};
+
+#define NUMBER_OF_BENCH_SCENARIOS ( sizeof(benchScenarios) / sizeof(benchScenarios[0]) )
+#define MAX_BENCH_REPEATS 1000
+#define BENCH_RESAMPLES 2000 // Bootstrap resamples, for the confidence interval on a change in the median
+#define BENCH_BASELINE_MAGIC "armChallenge-bench-baseline"
+#define BENCH_BASELINE_VERSION 1
+
+struct BenchOptions
+{
+  bool run;
+  u32int repeats; // Timed runs of each scenario
+  u32int warmup; // Untimed runs of each first, to fault in the code and data and let the clock settle
+  const char *only; // Just this scenario (NULL for all of them)
+  const char *baseline; // Compare against the samples stored here
+  const char *saveBaseline; // and store ours here
+  double tolerance; // A change in the median smaller than this (a fraction) is never reported
+};
+
+struct BenchSamples
+{
+  bool have;
+  u64int digest; // Of the ensemble's results, so we know a baseline did the same work
+  u32int number;
+  double ns[MAX_BENCH_REPEATS];
+};
+
+static int compareDoubles ( const void *a, const void *b )
+{
+  double da = *(const double *) a, db = *(const double *) b;
+  return ( da < db ) ? -1 : ( da > db );
+}
+
+// The median of v[0 .. n-1], sorting them in place
+double getMedian ( double *v, u32int n )
+{
+  qsort ( v, n, sizeof(double), compareDoubles );
+  return ( n % 2 == 1 ) ? v[n / 2] : ( v[n / 2 - 1] + v[n / 2] ) / 2;
+}
+
+// The median absolute deviation from the median, a spread that one descheduled run can't blow up
+double getMedianDeviation ( BenchSamples *bs, double median )
+{
+  double dev[MAX_BENCH_REPEATS];
+  for ( u32int i = 0; i < bs->number; i++ )
+  {
+    dev[i] = fabs ( bs->ns[i] - median );
+  }
+  return getMedian ( dev, bs->number );
+}
+
+double getSamplesMedian ( BenchSamples *bs )
+{
+  double v[MAX_BENCH_REPEATS];
+  memcpy ( v, bs->ns, bs->number * sizeof(double) );
+  return getMedian ( v, bs->number );
+}
+
+double getResampledMedian ( BenchSamples *bs, RandomStream *rs )
+{
+  double v[MAX_BENCH_REPEATS];
+  for ( u32int i = 0; i < bs->number; i++ )
+  {
+    v[i] = bs->ns[rs->next() % bs->number];
+  }
+  return getMedian ( v, bs->number );
+}
+
+// A 95% bootstrap confidence interval for median(now) / median(then), resampling both sets of runs. Run times are
+// skewed (a run can only be slowed down by the rest of the machine), so this assumes nothing about their shape.
+// The resampling has a fixed seed, so the same samples always get the same verdict.
+void getRatioInterval ( BenchSamples *now, BenchSamples *then, double *lo, double *hi )
+{
+  double *ratios = (double *) malloc ( BENCH_RESAMPLES * sizeof(double) );
+  RandomStream rs ( 1, 0 );
+  
+  for ( u32int r = 0; r < BENCH_RESAMPLES; r++ )
+  {
+    ratios[r] = getResampledMedian ( now, &rs ) / getResampledMedian ( then, &rs );
+  }
+  qsort ( ratios, BENCH_RESAMPLES, sizeof(double), compareDoubles );
+  *lo = ratios[(BENCH_RESAMPLES * 25) / 1000];
+  *hi = ratios[(BENCH_RESAMPLES * 975) / 1000 - 1];
+  free ( ratios );
+}
+
+// Baselines are text, a line of samples per scenario:
+//   armChallenge-bench-baseline 1
+//   scenario <name> <results digest> <runs> <ns per step> ...
+//   end
+bool writeBaseline ( const char *fileName, BenchSamples *samples )
+{
+  FILE *f = fopen ( fileName, "w" );
+  if ( f == NULL )
+  {
+    printf("error: could not open \"%s\" for writing\n", fileName);
+    return false;
+  }
+  
+  fprintf(f, "%s %d\n", BENCH_BASELINE_MAGIC, BENCH_BASELINE_VERSION);
+  for ( u32int s = 0; s < NUMBER_OF_BENCH_SCENARIOS; s++ )
+  {
+    if ( samples[s].have )
+    {
+      fprintf(f, "scenario %s %016llx %u", benchScenarios[s].name, (unsigned long long) samples[s].digest,
+              samples[s].number);
+      for ( u32int i = 0; i < samples[s].number; i++ )
+      {
+        fprintf(f, " %.6g", samples[s].ns[i]);
+      }
+      fprintf(f, "\n");
+    }
+  }
+  fprintf(f, "end\n");
+  
+  if ( ferror ( f ) != 0 || fclose ( f ) != 0 )
+  {
+    printf("error: failed writing \"%s\"\n", fileName);
+    return false;
+  }
+  return true;
+}
+
+bool readBaseline ( const char *fileName, BenchSamples *samples )
+{
+  FILE *f = fopen ( fileName, "r" );
+  if ( f == NULL )
+  {
+    printf("error: could not open \"%s\" for reading\n", fileName);
+    return false;
+  }
+  
+  char magic[64], tag[16] = "", name[64] = "";
+  int version = 0;
+  bool ok = ( fscanf(f, "%63s %d", magic, &version) == 2 && strcmp(magic, BENCH_BASELINE_MAGIC) == 0 &&
+              version == BENCH_BASELINE_VERSION );
+  
+  while ( ok && fscanf(f, "%15s", tag) == 1 && strcmp(tag, "end") != 0 )
+  {
+    unsigned long long digest = 0;
+    u32int number = 0;
+    
+    ok = ( strcmp(tag, "scenario") == 0 && fscanf(f, "%63s %llx %u", name, &digest, &number) == 3 &&
+           number > 0 && number <= MAX_BENCH_REPEATS );
+    if ( !ok )
+    {
+      break;
+    }
+    
+    // Scenarios we don't know (any more) are read past
+    BenchSamples ignored, *bs = &ignored;
+    for ( u32int s = 0; s < NUMBER_OF_BENCH_SCENARIOS; s++ )
+    {
+      if ( strcmp ( benchScenarios[s].name, name ) == 0 )
+      {
+        bs = &samples[s];
+      }
+    }
+    for ( u32int i = 0; ok && i < number; i++ )
+    {
+      ok = ( fscanf(f, "%lf", &bs->ns[i]) == 1 );
+    }
+    bs->have = ok;
+    bs->digest = digest;
+    bs->number = number;
+  }
+  ok = ok && ( strcmp(tag, "end") == 0 );
+  fclose ( f );
+  
+  if ( !ok )
+  {
+    printf("error: \"%s\" is not a valid benchmark baseline\n", fileName);
+  }
+  return ok;
+}
+
+// Runs scenario s once, giving its ns per replica step, or a negative number if it can't run with these options
+double runBenchScenario ( u32int s, EnsembleOptions *base, u64int *digest )
+{
+  BenchScenario *sc = &benchScenarios[s];
+  EnsembleOptions opts = *base;
+  struct timespec start, end;
+  
+  opts.replicas = sc->replicas;
+  if ( !sc->ownLine )
+  {
+    opts.steps = sc->steps;
+    opts.interleave = sc->interleave;
+    opts.lanes = sc->lanes;
+    opts.stationLanes = sc->stationLanes;
+    opts.line.beltLength = sc->beltLength;
+    opts.line.numberOfStations = sc->numberOfStations;
+    opts.line.compress = sc->compress;
+    opts.line.synthetic = sc->synthetic;
+    opts.line.syntheticSeed = 1;
+    opts.line.syntheticItems = 0;
+    opts.line.everyWorker = sc->everyWorker;
+  }
+  if ( !checkLineOptions ( &opts.line ) || !checkEnsembleOptions ( &opts ) )
+  {
+    return -1;
+  }
+  
+  EnsembleResults results ( opts.steps, opts.seed, getConfigurationHash ( &opts ) );
+  clock_gettime ( CLOCK_MONOTONIC, &start );
+  runReplicas ( 0, opts.replicas, &opts, &results );
+  clock_gettime ( CLOCK_MONOTONIC, &end );
+  
+  if ( results.getReplicas() != opts.replicas )
+  {
+    return -1; // An engine turned the line down
+  }
+  *digest = results.getDigest();
+  double ns = (double) (end.tv_sec - start.tv_sec) * 1e9 + (double) (end.tv_nsec - start.tv_nsec);
+  return ns / ( (double) opts.replicas * (double) opts.steps );
+}
+
+// Times each scenario, on one pinned core, bench->repeats times after bench->warmup untimed runs. The runs of the
+// scenarios are interleaved (one of each, then the next of each), so a slow stretch on a shared host lands on all
+// of them rather than all on one. A scenario is only called slower than the baseline when the whole confidence
+// interval for the change in its median is beyond the tolerance; the exit status is 1 if any is.
+int runBenchmarks ( BenchOptions *bench, EnsembleOptions *opts )
+{
+  BenchSamples *samples = (BenchSamples *) calloc ( NUMBER_OF_BENCH_SCENARIOS, sizeof(BenchSamples) );
+  BenchSamples *baseline = (BenchSamples *) calloc ( NUMBER_OF_BENCH_SCENARIOS, sizeof(BenchSamples) );
+  bool wanted[NUMBER_OF_BENCH_SCENARIOS];
+  u32int numberWanted = 0;
+  bool regressed = false;
+  int status = 0;
+  
+  for ( u32int s = 0; s < NUMBER_OF_BENCH_SCENARIOS; s++ )
+  {
+    wanted[s] = ( bench->only == NULL ) ? !benchScenarios[s].ownLine : ( strcmp ( bench->only, benchScenarios[s].name ) == 0 );
+    numberWanted += wanted[s] ? 1 : 0;
+  }
+  if ( numberWanted == 0 )
+  {
+    printf("error: no benchmark scenario \"%s\"\n", bench->only);
+    status = 1;
+  }
+  if ( status == 0 && bench->baseline != NULL && !readBaseline ( bench->baseline, baseline ) )
+  {
+    status = 1;
+  }
+  
+  // GK: Core 0 takes most of the interrupts, so use the next one (pinning wraps round on a single core machine)
+  if ( status == 0 && !pinThreadToCore ( 1 ) )
+  {
+    printf("warning: could not pin the benchmark to a core, expect more noise\n");
+  }
+  
+  for ( u32int r = 0; status == 0 && r < bench->warmup + bench->repeats; r++ )
+  {
+    for ( u32int s = 0; s < NUMBER_OF_BENCH_SCENARIOS; s++ )
+    {
+      if ( !wanted[s] )
+      {
+        continue;
+      }
+      u64int digest = 0;
+      double ns = runBenchScenario ( s, opts, &digest );
+      
+      if ( ns < 0 )
+      {
+        // Left out of a comparison, it could be hiding a regression
+        if ( baseline[s].have )
+        {
+          printf("error: scenario \"%s\" is in the baseline, but can't run with these options\n", benchScenarios[s].name);
+          regressed = true;
+        }
+        else
+        {
+          printf("warning: scenario \"%s\" can't run with these options, leaving it out\n", benchScenarios[s].name);
+        }
+        wanted[s] = false;
+        continue;
+      }
+      // Every run does exactly the same work, anything else would make the timings meaningless
+      if ( samples[s].have && digest != samples[s].digest )
+      {
+        printf("error: scenario \"%s\" gave different results from one run to the next\n", benchScenarios[s].name);
+        status = 1;
+        break;
+      }
+      samples[s].have = true;
+      samples[s].digest = digest;
+      if ( r >= bench->warmup )
+      {
+        samples[s].ns[samples[s].number++] = ns;
+      }
+    }
+  }
+  setAllocationPhase ( ALLOC_REPORT );
+  
+  for ( u32int s = 0; status == 0 && s < NUMBER_OF_BENCH_SCENARIOS; s++ )
+  {
+    BenchSamples *now = &samples[s], *then = &baseline[s];
+    if ( !wanted[s] || now->number == 0 )
+    {
+      continue;
+    }
+    double median = getSamplesMedian ( now ), spread = getMedianDeviation ( now, median );
+    
+    printf("%-14s %9.3f ns/step (MAD %.1f%%, %u runs)", benchScenarios[s].name, median, 100.0 * spread / median,
+           now->number);
+    if ( bench->baseline == NULL )
+    {
+      printf("\n");
+    }
+    else if ( !then->have )
+    {
+      printf(", not in the baseline\n");
+    }
+    else if ( then->digest != now->digest )
+    {
+      printf(", does different work from the baseline (digest %016llx, not %016llx), not compared\n",
+             (unsigned long long) now->digest, (unsigned long long) then->digest);
+    }
+    else
+    {
+      double lo, hi, was = getSamplesMedian ( then );
+      
+      getRatioInterval ( now, then, &lo, &hi );
+      bool slower = ( lo > 1.0 + bench->tolerance ), faster = ( hi < 1.0 - bench->tolerance );
+      printf(", baseline %.3f, %+.1f%% (95%% CI %+.1f%% to %+.1f%%)%s\n", was, 100.0 * (median / was - 1.0),
+             100.0 * (lo - 1.0), 100.0 * (hi - 1.0), slower ? " SLOWER" : faster ? " faster" : "");
+      regressed = regressed || slower;
+    }
+    // Roughly the half width of the interval a comparison would get (the median's standard error is about
+    // 1.86 MADs / sqrt(runs), and there are two medians). Past the tolerance, changes that size get lost in the noise.
+    double resolution = 5.0 * spread / median / sqrt ( (double) now->number );
+    if ( resolution > bench->tolerance )
+    {
+      printf("  warning: changes under about %.1f%% are lost in the noise, more --bench-repeat (or a quieter host) would help\n",
+             100.0 * resolution);
+    }
+  }
+  
+  // Never over a regression, that would quietly make it the new normal
+  status = ( status != 0 || regressed ) ? 1 : 0;
+  if ( status == 0 && bench->saveBaseline != NULL && !writeBaseline ( bench->saveBaseline, samples ) )
+  {
+    status = 1;
+  }
+  free ( samples );
+  free ( baseline );
+  return status;
+}
+
+// ------ Performance fuzzing: searching the line options for slow (or growing) lines ------
+//
+// Starting from the challenge's line, each trial mutates the worst line found so far (a few options at a time, any
+// the line checks turn down are tried again), and runs it as replica 0 of an ensemble would, keeping it if it's
+// worse still. Every so often it starts again from a fresh random line, so one slow corner doesn't hold the search.
+// "Worse" is one of:
+//   time    the fastest of several runs, in ns per step for each slot and worker (otherwise the longest line,
+//           doing the most work, would simply win), catching slow paths rather than big lines,
+//   memory  heap growth while the line runs (after the first quarter of its steps), in bytes per step, which
+//           should be 0.
+// The worst few are measured again and printed as command lines: for time, one timing the line with --bench's
+// "line" scenario, and for memory, one running it again (it's replica 0 of --seed 1, so the run is the same).  The
+// line it started from is never one of them, however slow it is, as it isn't something the search found.
+
+#define FUZZ_KEEP 5 // Worst lines reported
+#define FUZZ_RESTART 50 // Trials without a new worst before starting again from a random line
+#define FUZZ_MAX_LENGTH 2000
+#define FUZZ_MAX_STATIONS 300
+#define FUZZ_MIN_NS 10000000.0 // Time a line for at least this long (10ms), over as many runs as it takes
+
+struct FuzzOptions
+{
+  u32int trials; // 0 for no fuzzing
+  u64int seed; // of the search, not the lines
+  u64int steps; // Steps each line runs for
+  bool forMemory;
+};
+
+struct FuzzResult
+{
+  LineOptions line;
+  double score;
+  char args[512];
+};
+
+static const char *fuzzFeederItems[] = { "A", "B", "AB", "AAB", "ABB" };
+
+// Heap in use (glibc only, elsewhere the memory search finds nothing)
+u64int getHeapInUse ()
+{
+#if defined (__GLIBC__) && ( __GLIBC__ > 2 || __GLIBC_MINOR__ >= 33 )
+  return mallinfo2().uordblks;
+#else
+  return 0;
+#endif
+}
+
+// A weight, now and then an extreme one (the arrivals are drawn in floats, where a lopsided mix can leave the
+// probabilities summing short of 1)
+u32int getFuzzWeight ( RandomStream *rs )
+{
+  probability p = rs->nextProbability();
+  return ( p < 0.2 ) ? 0 : ( p < 0.4 ) ? 1 : ( p < 0.6 ) ? 1000000 : (u32int) ( rs->next() % 1000 );
+}
+
+// Changes one thing about the line
+void mutateLineOptions ( LineOptions *lo, RandomStream *rs )
+{
+  u32int slots = getLineLength ( lo );
+  
+  switch ( rs->next() % 12 )
+  {
+    case 0:
+      lo->numberOfStations = 1 + rs->next() % FUZZ_MAX_STATIONS;
+      lo->beltLength = lo->numberOfStations + 1 + rs->next() % ( 3 * lo->numberOfStations + 1 );
+      break;
+    case 1:
+      lo->beltLength = getLineStations ( lo ) + 1 + rs->next() % FUZZ_MAX_LENGTH;
+      break;
+    case 2:
+      lo->crew = 1 + rs->next() % MAX_STATION_CREW;
+      lo->synthetic = false;
+      break;
+    case 3:
+      if ( !lo->setWeights )
+      {
+        lo->itemWeights[0] = lo->itemWeights[1] = lo->itemWeights[2] = 50;
+      }
+      lo->setWeights = true;
+      lo->synthetic = false;
+      lo->itemWeights[rs->next() % 3] = getFuzzWeight ( rs );
+      break;
+    case 4:
+      lo->speedSlots = 1 + rs->next() % 4;
+      lo->speedSteps = 1 + rs->next() % 4;
+      break;
+    case 5:
+      lo->loop = !lo->loop;
+      lo->outputSlot = lo->loop ? (int) ( rs->next() % slots ) : -1;
+      lo->sinkCapacity = 0;
+      break;
+    case 6:
+      lo->sinkCapacity = rs->next() % 9;
+      lo->sinkItems = 1 + rs->next() % 3;
+      lo->sinkSteps = 1 + rs->next() % 4;
+      lo->sinkSlip = ( rs->next() % 2 == 0 );
+      lo->loop = false;
+      lo->outputSlot = -1;
+      break;
+    case 7:
+      lo->numberOfFloaters = rs->next() % 4;
+      for ( u32int f = 0; f < lo->numberOfFloaters; f++ )
+      {
+        lo->floaterSlot[f] = rs->next() % slots;
+      }
+      lo->reassignPolicy = ( rs->next() % 2 == 0 ) ? reassignToBlocked : reassignFromStarved;
+      lo->reassignInterval = 1 + rs->next() % 50;
+      lo->moveCost = rs->next() % 10;
+      break;
+    case 8:
+      lo->beltMtbf = ( rs->next() % 3 == 0 ) ? 0 : 5 + rs->next() % 500;
+      lo->beltMttr = 1 + rs->next() % 50;
+      lo->stationMtbf = ( rs->next() % 3 == 0 ) ? 0 : 5 + rs->next() % 500;
+      lo->stationMttr = 1 + rs->next() % 50;
+      break;
+    case 9:
+      lo->productSize = 1 + rs->next() % 4;
+      break;
+    case 10:
+      lo->numberOfFeeders = rs->next() % 3;
+      for ( u32int f = 0; f < lo->numberOfFeeders; f++ )
+      {
+        lo->feederSlot[f] = rs->next() % slots;
+        lo->feederRate[f] = (probability) ( rs->next() % 101 ) / 100;
+        lo->feederItems[f] = fuzzFeederItems[rs->next() % ( sizeof(fuzzFeederItems) / sizeof(fuzzFeederItems[0]) )];
+      }
+      break;
+    default:
+      if ( rs->next() % 2 == 0 )
+      {
+        lo->compress = !lo->compress;
+      }
+      else
+      {
+        lo->synthetic = !lo->synthetic;
+        lo->syntheticSeed = 1 + rs->next() % 1000;
+        lo->syntheticItems = 2 + rs->next() % ( strlen ( SYNTHETIC_COMPONENT_NAMES ) - 1 );
+        lo->setWeights = false;
+        lo->crew = 0;
+      }
+      break;
+  }
+}
+
+// How bad the line is (see above): runs it as replica 0 of an ensemble of seed 1, each time from a fresh build
+double measureLine ( LineOptions *lo, FuzzOptions *fuzz )
+{
+  RandomStream stream;
+  double best = -1, spent = 0;
+  
+  for ( u32int run = 0; run < 50 && ( run < 3 || spent < FUZZ_MIN_NS ) && !( fuzz->forMemory && run > 0 ); run++ )
+  {
+    struct timespec start, end;
+    
+    stream.setSeed ( 1, 0 );
+    setRandomStream ( &stream );
+    setAllocationPhase ( ALLOC_SETUP );
+    ProductionLine *line = buildSimpleLine ( lo );
+    u64int units = line->getBelt()->getNumberOfSlots() + line->getBelt()->getNumberOfWorkers();
+    
+    u64int heap = getHeapInUse();
+    
+    clock_gettime ( CLOCK_MONOTONIC, &start );
+    line->runSim ( fuzz->steps );
+    clock_gettime ( CLOCK_MONOTONIC, &end );
+    
+    double ns = (double) (end.tv_sec - start.tv_sec) * 1e9 + (double) (end.tv_nsec - start.tv_nsec);
+    double score = fuzz->forMemory ? ( (double) getHeapInUse() - (double) heap ) / (double) fuzz->steps :
+                                     ns / (double) fuzz->steps / (double) units;
+    best = ( best < 0 || score < best ) ? score : best; // The fastest run, the one least disturbed
+    spent += ns;
+    setAllocationPhase ( ALLOC_REPORT );
+    delete line;
+  }
+  setRandomStream ( NULL );
+  return best;
+}
+
+// Keeps the worst FUZZ_KEEP lines, worst first, each only once (and never the starting line, with startArgs)
+void keepFuzzResult ( FuzzResult *worst, u32int *number, LineOptions *lo, double score, const char *startArgs )
+{
+  FuzzResult r;
+  
+  r.line = *lo;
+  r.score = score;
+  formatLineOptions ( lo, r.args, sizeof(r.args) );
+  if ( strcmp ( r.args, startArgs ) == 0 )
+  {
+    return;
+  }
+  for ( u32int i = 0; i < *number; i++ )
+  {
+    if ( strcmp ( worst[i].args, r.args ) == 0 )
+    {
+      return;
+    }
+  }
+  if ( *number == FUZZ_KEEP && worst[FUZZ_KEEP - 1].score >= score )
+  {
+    return;
+  }
+  
+  // In place of the last (or after it, while there's room), then up past the better ones
+  u32int at = ( *number < FUZZ_KEEP ) ? (*number)++ : FUZZ_KEEP - 1;
+  while ( at > 0 && worst[at - 1].score < score )
+  {
+    worst[at] = worst[at - 1];
+    at--;
+  }
+  worst[at] = r;
+}
+
+int runFuzzer ( FuzzOptions *fuzz, LineOptions *start )
+{
+  RandomStream rs ( fuzz->seed, 0 );
+  FuzzResult worst[FUZZ_KEEP];
+  u32int numberWorst = 0, sinceWorse = 0;
+  LineOptions current = *start;
+  double currentScore = measureLine ( &current, fuzz );
+  const char *unit = fuzz->forMemory ? "bytes of heap growth per step" : "ns per step, per slot and worker";
+  char startArgs[sizeof(worst[0].args)];
+  
+  formatLineOptions ( start, startArgs, sizeof(startArgs) );
+  printf("Fuzzing for %s: %u trials of %llu steps (fuzz seed %llu)\n", fuzz->forMemory ? "memory" : "time",
+         fuzz->trials, (unsigned long long) fuzz->steps, (unsigned long long) fuzz->seed);
+  
+  for ( u32int t = 0; t < fuzz->trials; t++ )
+  {
+    LineOptions next = ( sinceWorse >= FUZZ_RESTART ) ? *start : current;
+    u32int changes = ( sinceWorse >= FUZZ_RESTART ) ? 8 : 1 + rs.next() % 3;
+    
+    // Until the checks pass, quietly
+    do
+    {
+      for ( u32int c = 0; c < changes; c++ )
+      {
+        mutateLineOptions ( &next, &rs );
+      }
+    } while ( !checkLineOptions ( &next, true ) );
+    
+    double score = measureLine ( &next, fuzz );
+    keepFuzzResult ( worst, &numberWorst, &next, score, startArgs );
+    if ( score > currentScore || sinceWorse >= FUZZ_RESTART )
+    {
+      if ( score > currentScore )
+      {
+        char args[512];
+        formatLineOptions ( &next, args, sizeof(args) );
+        printf("trial %u: %.3f %s:%s\n", t, score, unit, args);
+      }
+      current = next;
+      currentScore = score;
+      sinceWorse = 0;
+    }
+    else
+    {
+      sinceWorse++;
+    }
   }
-};
+  
+  // Time the worst again, as a slow trial may just have been unlucky
+  setAllocationPhase ( ALLOC_REPORT );
+  printf("Worst lines found (%s, measured again):\n", unit);
+  for ( u32int i = 0; i < numberWorst; i++ )
+  {
+    printf("  %.3f (was %.3f): challenge %s --steps %llu%s\n", measureLine ( &worst[i].line, fuzz ), worst[i].score,
+           fuzz->forMemory ? "--replicas 1 --seed 1" : "--bench --bench-only line --seed 1",
+           (unsigned long long) fuzz->steps, worst[i].args);
+  }
+  return 0;
+}
 
+void printUsage ()
+{
+  printf("usage: challenge [--steps S] [--loop ...]            run the challenge line once\n");
+  printf("       challenge --replicas N [options]             run an ensemble of N replicas\n");
+  printf("       challenge --merge OUT IN...                  merge partial results files\n");
+  printf("       challenge --bench [--baseline F] [options]   time the benchmark scenarios, against a baseline\n");
+  printf("       challenge --fuzz N [options]                 search N lines for the slowest (see runFuzzer)\n");
+  printf("options:\n");
+  printf("  --steps S       steps per replica (default %d), 64 bit\n", NUMBER_OF_STEPS);
+  printf("  --flush-every N on a single run, print the counts so far every N steps\n");
+  printf("  --loop          make the belt a loop, unclaimed items come round again\n");
+  printf("  --output-slot K on a loop, take finished items off at slot K\n");
+  printf("  --speed N[/M]   move the belt N slots every M steps (default 1)\n");
+  printf("  --sink C        send items off the end to an output sink holding C items\n");
+  printf("  --sink-rate N[/M] which takes N items away every M steps (default 1)\n");
+  printf("  --slip          when the sink is full, the belt slips rather than stopping\n");
+  printf("  --feeder S:R:IT  a side feeder at slot S, an item arriving with probability R each slot move,\n");
+  printf("                  one of the item names IT (so AAB is two A's to every B)\n");
+  printf("  --floater S     a floating worker, starting at slot S, who moves between stations\n");
+  printf("  --reassign P    floaters go where items are being missed (blocked, the default) or leave\n");
+  printf("                  stations with no items (starved)\n");
+  printf("  --reassign-every N  reconsider the floaters every N steps (default 10)\n");
+  printf("  --move-cost N   floaters take N steps to move (default 0)\n");
+  printf("  --belt-length L  a belt of L slots (default 5), with the stations spread evenly along it\n");
+  printf("  --stations N    N stations (default 3), each a pair of workers\n");
+  printf("  --compress      keep only the items between stations, not every slot, for long belts\n");
+  printf("  --synthetic X   a generated factory, the same for the same seed X: %d stations (or --stations) of\n",
+         DEFAULT_SYNTHETIC_STATIONS);
+  printf("                  differing workers, making parts and then P, with multi-level recipes\n");
+  printf("  --synthetic-items K  with K types of component (default %d), arriving with skewed weights\n",
+         DEFAULT_SYNTHETIC_ITEMS);
+  printf("  --product-size K  finished products take up K slots on the belt\n");
+  printf("  --weights A/B/N  arrival weights of A, B and gaps (default 50/50/50)\n");
+  printf("  --crew K        K workers at each station (default 2)\n");
+  printf("  --belt-breakdowns B/R     the belt breaks down every B steps, for R steps to repair, on average\n");
+  printf("  --station-breakdowns B/R  and likewise each station\n");
+  printf("  --seed X        ensemble seed (default 1)\n");
+  printf("  --shards K      split the ensemble into K processes, writing OUT.0 .. OUT.K-1\n");
+  printf("  --shard I/K     run only shard I of K in this process, writing OUT\n");
+  printf("  --out OUT       partial results file (or prefix, with --shards)\n");
+  printf("  --threads T     run the replicas on T threads in each process (default 1)\n");
+  printf("  --interleave B  step B replicas in turn on each thread, overlapping their cache misses\n");
+  printf("  --lanes N       run N replicas (up to %d) at a time, lane-wise in the lane engine\n", ENGINE_LANES);
+  printf("  --until ITEM:N  stop each run once N of ITEM are collected (up to %d of these, the first reached\n",
+         MAX_RUN_TARGETS);
+  printf("                  stops it), with --steps the most it runs for\n");
+  printf("  --stop-when C   run a single line until condition C holds, and print its state (see StopCondition),\n");
+  printf("                  e.g. \"waiting=all\" or \"slot:3=empty@20\"\n");
+  printf("  --station-lanes work all the stations of a line at once, lane-wise, for long lines\n");
+  printf("  --pin           pin threads to cores, keeping their state on the local NUMA node\n");
+  printf("  --huge-pages M  back large belts with huge pages, M is thp or explicit\n");
+  printf("  --every-worker  give every worker a turn each step, not just one drawn at random (as generated\n");
+  printf("                  factories always do)\n");
+  printf("benchmark options:\n");
+  printf("  --bench-repeat N  time each scenario N times (default 15, up to %d)\n", MAX_BENCH_REPEATS);
+  printf("  --bench-warmup N  after N untimed runs (default 2)\n");
+  printf("  --bench-only NAME just the one scenario (\"line\" for the line given by the other options)\n");
+  printf("  --baseline F    compare with the runs stored in F, failing if a scenario is slower\n");
+  printf("  --save-baseline F  store the runs in F, for later comparison\n");
+  printf("  --tolerance P   ignore changes in the median of less than P percent (default 3)\n");
+  printf("fuzzing options (the other line options give the line to start from):\n");
+  printf("  --fuzz-for W    the slowest lines (time, the default) or those whose heap grows as they run (memory)\n");
+  printf("  --fuzz-steps S  run each line for S steps (default 2000)\n");
+  printf("  --fuzz-seed X   seed of the search (default 1)\n");
+}
 
-#define NUMBER_OF_STEPS 100 
-        
-int main (void)
+int runEnsemble ( EnsembleOptions *opts )
 {
-  printf("ARM production line coding challenge\n\n");
+  if ( opts->shards > 1 && opts->shardIndex < 0 )
+  {
+    if ( opts->outName == NULL )
+    {
+      printf("error: --shards needs --out to name the partial results files\n");
+      return 1;
+    }
+    return ( runShardedEnsemble ( opts ) == 0 ) ? 0 : 1;
+  }
   
-  // In this simple sim we have two item types 
+  // Just the one shard (possibly all of the replicas) in this process
+  u64int first, last;
+  u32int shard = ( opts->shardIndex < 0 ) ? 0 : opts->shardIndex;
+  getShardRange ( opts->replicas, opts->shards, shard, &first, &last );
   
-  ItemType *itemA = new ItemType( 'A' ); // Component A
-  ItemType *itemB = new ItemType( 'B' ); // Component B
-  ItemType *itemP = new ItemType( 'P' ); // A finished component, consisting in the simple case of A + B
+  EnsembleResults results ( opts->steps, opts->seed, getConfigurationHash ( opts ) );
+  runReplicasOnThreads ( first, last, opts, &results );
+  results.coverReplicas ( first, last );
+  results.print();
+  
+  if ( opts->outName != NULL && !results.write ( opts->outName ) )
+  {
+    return 1;
+  }
+  return 0;
+}
 
-  // P consists of components A and B.
-  ItemType *componentsNeededForP[] = { itemA, itemB, NULL };
-  itemP->setComponentsRequired ( componentsNeededForP );
+int main (int argc, char **argv)
+{
+  EnsembleOptions opts = {}; // Anything not set here starts off 0, false or NULL
+  opts.steps = NUMBER_OF_STEPS;
+  opts.seed = 1;
+  opts.shards = 1;
+  opts.shardIndex = -1;
+  opts.threads = 1;
+  opts.interleave = 1;
+  opts.line.outputSlot = -1;
+  opts.line.speedSlots = 1;
+  opts.line.speedSteps = 1;
+  opts.line.sinkItems = 1;
+  opts.line.sinkSteps = 1;
+  opts.line.reassignPolicy = reassignToBlocked;
+  opts.line.reassignInterval = 10;
+  BenchOptions bench = { false, 15, 2, NULL, NULL, NULL, 0.03 };
+  FuzzOptions fuzz = { 0, 1, 2000, false };
   
-  ItemType *nullItem = new ItemType( /* NULL item */ );
+  for ( int a = 1; a < argc; a++ )
+  {
+    bool haveValue = ( a + 1 < argc );
+    
+    if ( strcmp ( argv[a], "--merge" ) == 0 && haveValue )
+    {
+      return mergePartialResults ( argv[a + 1], argc - (a + 2), &argv[a + 2] );
+    }
+    else if ( strcmp ( argv[a], "--replicas" ) == 0 && haveValue )
+    {
+      opts.replicas = strtoull ( argv[++a], NULL, 0 );
+    }
+    else if ( strcmp ( argv[a], "--steps" ) == 0 && haveValue )
+    {
+      opts.steps = strtoull ( argv[++a], NULL, 0 );
+    }
+    else if ( strcmp ( argv[a], "--flush-every" ) == 0 && haveValue )
+    {
+      opts.flushEvery = strtoull ( argv[++a], NULL, 0 );
+    }
+    else if ( strcmp ( argv[a], "--loop" ) == 0 )
+    {
+      opts.line.loop = true;
+    }
+    else if ( strcmp ( argv[a], "--output-slot" ) == 0 && haveValue )
+    {
+      opts.line.outputSlot = atoi ( argv[++a] );
+    }
+    else if ( strcmp ( argv[a], "--speed" ) == 0 && haveValue )
+    {
+      opts.line.speedSteps = 1;
+      if ( sscanf ( argv[++a], "%u/%u", &opts.line.speedSlots, &opts.line.speedSteps ) < 1 || opts.line.speedSteps == 0 )
+      {
+        printf("error: --speed wants N or N/M, with M > 0\n");
+        return 1;
+      }
+    }
+    else if ( strcmp ( argv[a], "--sink" ) == 0 && haveValue )
+    {
+      opts.line.sinkCapacity = strtoul ( argv[++a], NULL, 0 );
+    }
+    else if ( strcmp ( argv[a], "--sink-rate" ) == 0 && haveValue )
+    {
+      opts.line.sinkSteps = 1;
+      if ( sscanf ( argv[++a], "%u/%u", &opts.line.sinkItems, &opts.line.sinkSteps ) < 1 || opts.line.sinkSteps == 0 )
+      {
+        printf("error: --sink-rate wants N or N/M, with M > 0\n");
+        return 1;
+      }
+    }
+    else if ( strcmp ( argv[a], "--feeder" ) == 0 && haveValue )
+    {
+      u32int f = opts.line.numberOfFeeders;
+      int used = 0;
+      
+      if ( f == MAX_LINE_FEEDERS ||
+           sscanf ( argv[++a], "%u:%f:%n", &opts.line.feederSlot[f], &opts.line.feederRate[f], &used ) != 2 || used == 0 )
+      {
+        printf("error: --feeder wants SLOT:RATE:ITEMS, at most %d times\n", MAX_LINE_FEEDERS);
+        return 1;
+      }
+      opts.line.feederItems[f] = argv[a] + used;
+      opts.line.numberOfFeeders++;
+    }
+    else if ( strcmp ( argv[a], "--floater" ) == 0 && haveValue )
+    {
+      if ( opts.line.numberOfFloaters == MAX_LINE_FLOATERS )
+      {
+        printf("error: at most %d floaters\n", MAX_LINE_FLOATERS);
+        return 1;
+      }
+      opts.line.floaterSlot[opts.line.numberOfFloaters++] = strtoul ( argv[++a], NULL, 0 );
+    }
+    else if ( strcmp ( argv[a], "--reassign" ) == 0 && haveValue )
+    {
+      a++;
+      if ( strcmp ( argv[a], "blocked" ) == 0 )
+      {
+        opts.line.reassignPolicy = reassignToBlocked;
+      }
+      else if ( strcmp ( argv[a], "starved" ) == 0 )
+      {
+        opts.line.reassignPolicy = reassignFromStarved;
+      }
+      else
+      {
+        printUsage();
+        return 1;
+      }
+    }
+    else if ( strcmp ( argv[a], "--reassign-every" ) == 0 && haveValue )
+    {
+      opts.line.reassignInterval = strtoul ( argv[++a], NULL, 0 );
+    }
+    else if ( strcmp ( argv[a], "--move-cost" ) == 0 && haveValue )
+    {
+      opts.line.moveCost = strtoul ( argv[++a], NULL, 0 );
+    }
+    else if ( ( strcmp ( argv[a], "--belt-breakdowns" ) == 0 || strcmp ( argv[a], "--station-breakdowns" ) == 0 ) &&
+              haveValue )
+    {
+      bool ofBelt = ( argv[a][2] == 'b' );
+      u32int between, repair;
+      
+      if ( sscanf ( argv[++a], "%u/%u", &between, &repair ) != 2 || between == 0 || repair == 0 )
+      {
+        printf("error: %s wants B/R, both more than 0\n", argv[a - 1]);
+        return 1;
+      }
+      *( ofBelt ? &opts.line.beltMtbf : &opts.line.stationMtbf ) = between;
+      *( ofBelt ? &opts.line.beltMttr : &opts.line.stationMttr ) = repair;
+    }
+    else if ( strcmp ( argv[a], "--belt-length" ) == 0 && haveValue )
+    {
+      opts.line.beltLength = strtoul ( argv[++a], NULL, 0 );
+    }
+    else if ( strcmp ( argv[a], "--stations" ) == 0 && haveValue )
+    {
+      opts.line.numberOfStations = strtoul ( argv[++a], NULL, 0 );
+    }
+    else if ( strcmp ( argv[a], "--compress" ) == 0 )
+    {
+      opts.line.compress = true;
+    }
+    else if ( strcmp ( argv[a], "--synthetic" ) == 0 && haveValue )
+    {
+      opts.line.synthetic = true;
+      opts.line.syntheticSeed = strtoull ( argv[++a], NULL, 0 );
+    }
+    else if ( strcmp ( argv[a], "--synthetic-items" ) == 0 && haveValue )
+    {
+      opts.line.syntheticItems = strtoul ( argv[++a], NULL, 0 );
+    }
+    else if ( strcmp ( argv[a], "--weights" ) == 0 && haveValue )
+    {
+      opts.line.setWeights = true;
+      if ( sscanf ( argv[++a], "%u/%u/%u", &opts.line.itemWeights[0], &opts.line.itemWeights[1],
+                    &opts.line.itemWeights[2] ) != 3 )
+      {
+        printf("error: --weights wants A/B/N\n");
+        return 1;
+      }
+    }
+    else if ( strcmp ( argv[a], "--crew" ) == 0 && haveValue )
+    {
+      opts.line.crew = strtoul ( argv[++a], NULL, 0 );
+    }
+    else if ( strcmp ( argv[a], "--product-size" ) == 0 && haveValue )
+    {
+      opts.line.productSize = strtoul ( argv[++a], NULL, 0 );
+    }
+    else if ( strcmp ( argv[a], "--slip" ) == 0 )
+    {
+      opts.line.sinkSlip = true;
+    }
+    else if ( strcmp ( argv[a], "--seed" ) == 0 && haveValue )
+    {
+      opts.seed = strtoull ( argv[++a], NULL, 0 );
+    }
+    else if ( strcmp ( argv[a], "--shards" ) == 0 && haveValue )
+    {
+      opts.shards = strtoul ( argv[++a], NULL, 0 );
+    }
+    else if ( strcmp ( argv[a], "--shard" ) == 0 && haveValue )
+    {
+      if ( sscanf ( argv[++a], "%d/%u", &opts.shardIndex, &opts.shards ) != 2 )
+      {
+        opts.shards = 0; // Caught below
+      }
+    }
+    else if ( strcmp ( argv[a], "--out" ) == 0 && haveValue )
+    {
+      opts.outName = argv[++a];
+    }
+    else if ( strcmp ( argv[a], "--threads" ) == 0 && haveValue )
+    {
+      opts.threads = strtoul ( argv[++a], NULL, 0 );
+    }
+    else if ( strcmp ( argv[a], "--interleave" ) == 0 && haveValue )
+    {
+      opts.interleave = strtoul ( argv[++a], NULL, 0 );
+    }
+    else if ( strcmp ( argv[a], "--until" ) == 0 && haveValue )
+    {
+      // ITEM:N, an item name and how many of it to collect
+      char *end = NULL;
+      const char *spec = argv[++a];
+      u32int t = opts.targets.number;
+      
+      if ( t == MAX_RUN_TARGETS || spec[0] == '\0' || spec[1] != ':' )
+      {
+        printUsage();
+        return 1;
+      }
+      opts.targets.name[t] = spec[0];
+      opts.targets.count[t] = strtoull ( spec + 2, &end, 0 );
+      if ( end == spec + 2 || *end != '\0' )
+      {
+        printUsage();
+        return 1;
+      }
+      opts.targets.number++;
+    }
+    else if ( strcmp ( argv[a], "--stop-when" ) == 0 && haveValue )
+    {
+      opts.stopWhen = argv[++a];
+    }
+    else if ( strcmp ( argv[a], "--station-lanes" ) == 0 )
+    {
+      opts.stationLanes = true;
+    }
+    else if ( strcmp ( argv[a], "--lanes" ) == 0 && haveValue )
+    {
+      opts.lanes = strtoul ( argv[++a], NULL, 0 );
+    }
+    else if ( strcmp ( argv[a], "--pin" ) == 0 )
+    {
+      opts.pinThreads = true;
+    }
+    else if ( strcmp ( argv[a], "--every-worker" ) == 0 )
+    {
+      opts.line.everyWorker = true;
+    }
+    else if ( strcmp ( argv[a], "--fuzz" ) == 0 && haveValue )
+    {
+      fuzz.trials = strtoul ( argv[++a], NULL, 0 );
+    }
+    else if ( strcmp ( argv[a], "--fuzz-for" ) == 0 && haveValue )
+    {
+      a++;
+      if ( strcmp ( argv[a], "time" ) != 0 && strcmp ( argv[a], "memory" ) != 0 )
+      {
+        printUsage();
+        return 1;
+      }
+      fuzz.forMemory = ( strcmp ( argv[a], "memory" ) == 0 );
+    }
+    else if ( strcmp ( argv[a], "--fuzz-steps" ) == 0 && haveValue )
+    {
+      fuzz.steps = strtoull ( argv[++a], NULL, 0 );
+    }
+    else if ( strcmp ( argv[a], "--fuzz-seed" ) == 0 && haveValue )
+    {
+      fuzz.seed = strtoull ( argv[++a], NULL, 0 );
+    }
+    else if ( strcmp ( argv[a], "--bench" ) == 0 )
+    {
+      bench.run = true;
+    }
+    else if ( strcmp ( argv[a], "--bench-repeat" ) == 0 && haveValue )
+    {
+      bench.repeats = strtoul ( argv[++a], NULL, 0 );
+      if ( bench.repeats == 0 || bench.repeats > MAX_BENCH_REPEATS )
+      {
+        printf("error: --bench-repeat wants 1 to %d\n", MAX_BENCH_REPEATS);
+        return 1;
+      }
+    }
+    else if ( strcmp ( argv[a], "--bench-warmup" ) == 0 && haveValue )
+    {
+      bench.warmup = strtoul ( argv[++a], NULL, 0 );
+    }
+    else if ( strcmp ( argv[a], "--bench-only" ) == 0 && haveValue )
+    {
+      bench.only = argv[++a];
+    }
+    else if ( strcmp ( argv[a], "--baseline" ) == 0 && haveValue )
+    {
+      bench.baseline = argv[++a];
+    }
+    else if ( strcmp ( argv[a], "--save-baseline" ) == 0 && haveValue )
+    {
+      bench.saveBaseline = argv[++a];
+    }
+    else if ( strcmp ( argv[a], "--tolerance" ) == 0 && haveValue )
+    {
+      bench.tolerance = atof ( argv[++a] ) / 100.0;
+    }
+    else if ( strcmp ( argv[a], "--huge-pages" ) == 0 && haveValue )
+    {
+      a++;
+      if ( strcmp ( argv[a], "thp" ) == 0 )
+      {
+        setHugePageMode ( HUGE_PAGES_TRANSPARENT );
+      }
+      else if ( strcmp ( argv[a], "explicit" ) == 0 )
+      {
+        setHugePageMode ( HUGE_PAGES_EXPLICIT );
+      }
+      else
+      {
+        printUsage();
+        return 1;
+      }
+    }
+    else
+    {
+      printUsage();
+      return 1;
+    }
+  }
   
-  // We have a belt with 5 slots
-  Belt *belt = new Belt( 5 /* 5 slots, space for three pairs of workers, plus an entry and an exit slot */ );
+  if ( opts.shards == 0 || opts.shardIndex >= (int) opts.shards )
+  {
+    printf("error: bad shard specification\n");
+    return 1;
+  }
   
-  // Add item factories to the belt, in the simple sim, giving them all the same weighting makes them equally likely to appear.
-  // so the chance of say 'A' appearing is 50 / 150 ( weighting / total weighting ).
-  belt->addItemFactory ( itemA, 50 /* Probability weighting (from 0 to 100 (most likely)) */ );
-  belt->addItemFactory ( itemB, 50 );
-  belt->addItemFactory ( nullItem, 50 );
-
-  DEBUG("Probability of component A appearing = %f\n", itemA->getGenerationProbability());
-  DEBUG("Probability of component B appearing = %f\n", itemB->getGenerationProbability());
-  DEBUG("Probability of no component appearing = %f\n", nullItem->getGenerationProbability());
+  if ( !checkLineOptions ( &opts.line ) )
+  {
+    return 1;
+  }
   
-  // Add a finished item type to the belt.
-  belt->addFinishedItem ( itemP );
+  if ( opts.lanes > 0 && opts.replicas == 0 )
+  {
+    printf("error: --lanes steps the replicas of an ensemble together, it needs --replicas\n");
+    return 1;
+  }
+  if ( !checkEnsembleOptions ( &opts ) )
+  {
+    return 1;
+  }
   
-  // Add our six workers, in pairs of two per slot. We don't care to model here which side of the belt they stand on,
-  // for the simulation in question, it matters not.  The Belt class keeps track of the workers, and will delete them
-  // on our behalf once it is itself destroyed.  We instantiate these workers with default parameters and expecting them to be identical.
+  if ( opts.targets.number > 0 )
+  {
+    // The lane and station engines run their replicas for every step, they don't watch for targets
+    if ( opts.lanes > 0 || opts.stationLanes )
+    {
+      printf("error: --until needs the ordinary engine, not --lanes or --station-lanes\n");
+      return 1;
+    }
+    ProductionLine *line = buildSimpleLine( &opts.line );
+    for ( u32int t = 0; t < opts.targets.number; t++ )
+    {
+      if ( line->findItemType ( opts.targets.name[t] ) == NULL )
+      {
+        printf("error: no item \"%c\" on the line to stop at\n", opts.targets.name[t]);
+        delete line;
+        return 1;
+      }
+    }
+    delete line;
+  }
   
-  belt->addWorker( new Worker(), 1 /* position in the line */);
-  belt->addWorker( new Worker(), 1 /* position in the line */);
-
-  belt->addWorker( new Worker(), 2 /* position in the line */);
-  belt->addWorker( new Worker(), 2 /* position in the line */);
-
-  belt->addWorker( new Worker(), 3 /* position in the line */);
-  belt->addWorker( new Worker(), 3 /* position in the line */);
+  if ( opts.stopWhen != NULL && ( opts.replicas > 0 || opts.stationLanes || opts.flushEvery > 0 ||
+                                  opts.targets.number > 0 ) )
+  {
+    printf("error: --stop-when is for a single run, on its own\n");
+    return 1;
+  }
   
-  // Setup and run the production line sim
+  if ( fuzz.trials > 0 )
+  {
+    if ( opts.replicas > 0 || bench.run || opts.stopWhen != NULL || opts.flushEvery > 0 || fuzz.steps == 0 )
+    {
+      printf("error: --fuzz runs its own lines, without --replicas, --bench, --stop-when or --flush-every\n");
+      return 1;
+    }
+    int status = runFuzzer ( &fuzz, &opts.line );
+    return checkAllocations() ? status : 1;
+  }
   
-  ProductionLine *sim = new ProductionLine();
+  if ( bench.run )
+  {
+    // The scenarios say how many replicas and steps, and each is timed in this one process, on one thread
+    if ( opts.replicas > 0 || opts.shards > 1 || opts.threads > 1 || opts.stopWhen != NULL || opts.flushEvery > 0 )
+    {
+      printf("error: --bench runs its own scenarios, without --replicas, --shards, --threads, --stop-when or --flush-every\n");
+      return 1;
+    }
+    int status = runBenchmarks ( &bench, &opts );
+    return checkAllocations() ? status : 1;
+  }
   
-  // the production line class remembers to delete its belt (if present) when destroyed.
-  sim->addBelt ( belt );
+  if ( opts.replicas > 0 )
+  {
+    int status = runEnsemble ( &opts );
+    return checkAllocations() ? status : 1;
+  }
+  
+  printf("ARM production line coding challenge\n\n");
   
-  printf("Running production line for %d steps\n",NUMBER_OF_STEPS);
-  sim->runSim( NUMBER_OF_STEPS /* iterations of the conveyor belt */);
+  // Setup and run the production line sim
+  ProductionLine *sim = buildSimpleLine( &opts.line );
+  
+  StopCondition condition;
+  if ( opts.stopWhen != NULL && ( !condition.parse ( opts.stopWhen ) || !condition.compile ( sim ) ) )
+  {
+    delete sim;
+    return 1;
+  }
+  
+  if ( opts.line.synthetic )
+  {
+    printf("Synthetic factory %llu: %u stations, %u workers, on a belt of %u slots\n",
+           (unsigned long long) opts.line.syntheticSeed, sim->getBelt()->getNumberOfStations(),
+           sim->getBelt()->getNumberOfWorkers(), sim->getBelt()->getNumberOfSlots());
+    sim->getBelt()->printRecipes();
+  }
+  printf("Running production line for %llu steps\n", (unsigned long long) opts.steps);
+  if ( opts.stopWhen != NULL )
+  {
+    bool met = false;
+    
+    condition.run ( sim, opts.steps, &met );
+    setAllocationPhase ( ALLOC_REPORT );
+    if ( met )
+    {
+      printf("Stopped after %llu steps, where \"%s\" holds\n", (unsigned long long) sim->getStepNumber(), opts.stopWhen);
+    }
+    else
+    {
+      printf("\"%s\" didn't hold in %llu steps\n", opts.stopWhen, (unsigned long long) sim->getStepNumber());
+    }
+    sim->getBelt()->printState();
+  }
+  else if ( opts.stationLanes )
+  {
+    // The engine keeps its own counts, which go back into the line's item types for the report
+    if ( !StationEngine::canRun ( sim->getBelt() ) )
+    {
+      printf("error: this line doesn't fit the station engine\n");
+      delete sim;
+      return 1;
+    }
+    StationEngine *engine = new StationEngine ( sim->getBelt() );
+    setAllocationPhase ( ALLOC_RUN );
+    engine->run ( opts.steps );
+    setAllocationPhase ( ALLOC_REPORT );
+    for ( u32int i = 0; i < engine->getNumberReported(); i++ )
+    {
+      engine->getReportedItem ( i )->addNumberCollected ( engine->getReportedCount ( i ) );
+    }
+    delete engine;
+  }
+  else if ( opts.flushEvery > 0 )
+  {
+    sim->runSimFlushing ( opts.steps, opts.flushEvery, &opts.targets );
+  }
+  else
+  {
+    sim->runSim( opts.steps /* iterations of the conveyor belt */, &opts.targets );
+  }
+  setAllocationPhase ( ALLOC_REPORT );
+  if ( opts.targets.number > 0 )
+  {
+    int reached = sim->getReachedTarget ( &opts.targets );
+    if ( reached >= 0 )
+    {
+      printf("Reached the target of %llu \"%c\" after %llu steps\n", (unsigned long long) opts.targets.count[reached],
+             opts.targets.name[reached], (unsigned long long) sim->getStepNumber());
+    }
+    else
+    {
+      printf("No target reached in %llu steps\n", (unsigned long long) sim->getStepNumber());
+    }
+  }
   sim->printResults();
   
   delete sim;
   
-  return (0); // Tell the shell we were successful.
+  return checkAllocations() ? 0 : 1; // Tell the shell we were successful.
 }
-
-